@@ -78,6 +78,7 @@ DECLARE(packageSlot, "packageSlot");
 DECLARE(attributes, "attributes");
 DECLARE(c, "c");
 DECLARE(standardGeneric, "standardGeneric");
+DECLARE(rirPacked, "rir.packed");
 
 #undef DECLARE
 } // namespace symbol
@@ -535,6 +535,13 @@ class DataflowAnalysis
         current()[sym] = v;
     }
 
+    void clear_(CodeEditor::Iterator ins) override {
+        SEXP sym = Pool::get((*ins).immediate.pool);
+        // the binding stays, but we do not know its value anymore
+        if (current()[sym].isPresent())
+            current()[sym] = FValue::Value(FValue::UseDef::multiuse());
+    }
+
     void call_(CodeEditor::Iterator ins) override {
         current().pop();
         // TODO we could be fancy and if its known whether fun is eager or lazy
@@ -686,6 +693,7 @@ class DataflowAnalysis
         case Opcode::is_:
         case Opcode::isfun_:
         case Opcode::extract1_:
+        case Opcode::extract1_unchecked_:
         case Opcode::subset1_:
         case Opcode::extract2_:
         case Opcode::subset2_:
@@ -708,6 +716,13 @@ class DataflowAnalysis
         }
     }
 
+    // does not call anything, even though it is not pure
+    void for_step_(CodeEditor::Iterator ins) override {
+        current().pop(2);
+        current().push(FValue::Value(ins));
+        current().push(FValue::Value(ins));
+    }
+
     void dup_(CodeEditor::Iterator ins) override {
         auto v = current().pop();
         v.used(ins);
@@ -720,8 +735,11 @@ class DataflowAnalysis
         auto& b = current().stack()[1];
         a.used(ins);
         b.used(ins);
-        current().push(a.duplicate(ins));
-        current().push(b.duplicate(ins));
+        // a and b are invalidated by pushing
+        auto da = a.duplicate(ins);
+        auto db = b.duplicate(ins);
+        current().push(da);
+        current().push(db);
     }
 
     void return_(CodeEditor::Iterator ins) override {
@@ -110,11 +110,41 @@ protected:
         current().insert(bc.immediateConst());
     }
 
+    void ldddvar_(CodeEditor::Iterator ins) override {
+        BC bc = *ins;
+        current().insert(bc.immediateConst());
+    }
+
+    void ldlval_(CodeEditor::Iterator ins) override {
+        BC bc = *ins;
+        current().insert(bc.immediateConst());
+    }
+
+    void ldfun_(CodeEditor::Iterator ins) override {
+        BC bc = *ins;
+        current().insert(bc.immediateConst());
+    }
+
+    void missing_(CodeEditor::Iterator ins) override {
+        BC bc = *ins;
+        current().insert(bc.immediateConst());
+    }
+
+    void guard_fun_(CodeEditor::Iterator ins) override {
+        BC bc = *ins;
+        current().insert(Pool::get(bc.immediate.guard_fun_args.name));
+    }
+
     void stvar_(CodeEditor::Iterator ins) override {
         BC bc = *ins;
         current().erase(bc.immediateConst());
     }
 
+    void clear_(CodeEditor::Iterator ins) override {
+        BC bc = *ins;
+        current().erase(bc.immediateConst());
+    }
+
     void ret_(CodeEditor::Iterator ins) override {
     }
 
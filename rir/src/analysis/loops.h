@@ -0,0 +1,129 @@
+#pragma once
+
+#include "analysis_framework/analysis.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+namespace rir {
+
+/** Finds the natural loops of the code.
+ *
+ * The compiler emits structured code: a loop starts with its header label,
+ * possibly preceded by a beginloop_, and ends with the br_ jumping back to it.
+ * A backward jump thus closes a loop consisting of all instructions between
+ * the label and the jump. Loops which can be entered other than through their
+ * header are not reported.
+ */
+class LoopAnalysis : public Analysis {
+  public:
+    struct Loop {
+        /// The label the back edges jump to
+        CodeEditor::Iterator header;
+        /// The last back edge
+        CodeEditor::Iterator latch;
+        /// Code inserted before this instruction runs once before the loop
+        /// is entered, it is the end of the code if there is no such place
+        CodeEditor::Iterator preheader;
+        /// Positions of header and latch in instructions
+        size_t begin, end;
+
+        bool contains(size_t pos) const { return pos >= begin && pos <= end; }
+    };
+
+    /// Sorted by size, so inner loops come before the loops around them
+    std::vector<Loop> loops;
+
+    /// All instructions in code order, positions refer to this
+    std::vector<CodeEditor::Iterator> instructions;
+
+    void invalidate() override {
+        loops.clear();
+        instructions.clear();
+        Analysis::invalidate();
+    }
+
+    void print() override {
+        for (auto& l : loops)
+            Rprintf("loop %zu - %zu%s\n", l.begin, l.end,
+                    l.preheader == code_->end() ? " (no preheader)" : "");
+    }
+
+  protected:
+    void doAnalyze() override {
+        std::unordered_map<LabelT, size_t> labels;
+        for (auto i = code_->begin(); i != code_->end(); ++i) {
+            if ((*i).isLabel())
+                labels[(*i).immediate.offset] = instructions.size();
+            instructions.push_back(i);
+        }
+
+        // header position -> last back edge
+        std::unordered_map<size_t, size_t> backEdges;
+        for (size_t pos = 0; pos < instructions.size(); ++pos) {
+            BC bc = *instructions[pos];
+            if (!bc.isJmp())
+                continue;
+            size_t target = labels.at(bc.immediate.offset);
+            if (target <= pos && backEdges[target] < pos)
+                backEdges[target] = pos;
+        }
+
+        for (auto& e : backEdges) {
+            Loop l;
+            l.begin = e.first;
+            l.end = e.second;
+            l.header = instructions[l.begin];
+            l.latch = instructions[l.end];
+            if (!singleEntry(l, labels))
+                continue;
+            l.preheader = findPreheader(l, labels);
+            loops.push_back(l);
+        }
+
+        std::sort(loops.begin(), loops.end(), [](const Loop& a, const Loop& b) {
+            return a.end - a.begin < b.end - b.begin;
+        });
+    }
+
+  private:
+    bool singleEntry(const Loop& l,
+                     const std::unordered_map<LabelT, size_t>& labels) {
+        for (size_t pos = 0; pos < instructions.size(); ++pos) {
+            if (l.contains(pos))
+                continue;
+            BC bc = *instructions[pos];
+            if (!bc.isJmp())
+                continue;
+            size_t target = labels.at(bc.immediate.offset);
+            if (target > l.begin && target <= l.end)
+                return false;
+        }
+        return true;
+    }
+
+    CodeEditor::Iterator
+    findPreheader(const Loop& l,
+                  const std::unordered_map<LabelT, size_t>& labels) {
+        // Only the fallthrough may enter through the header
+        for (size_t pos = 0; pos < instructions.size(); ++pos) {
+            if (l.contains(pos))
+                continue;
+            BC bc = *instructions[pos];
+            if (bc.isJmp() && labels.at(bc.immediate.offset) == l.begin)
+                return code_->end();
+        }
+
+        size_t entry = l.begin;
+        if (entry > 0 && (*instructions[entry - 1]).is(Opcode::beginloop_))
+            --entry;
+        if (entry == 0)
+            return code_->end();
+        BC prev = *instructions[entry - 1];
+        if (prev.isUncondJmp() || prev.isReturn())
+            return code_->end();
+        return instructions[entry];
+    }
+};
+}
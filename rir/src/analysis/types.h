@@ -0,0 +1,672 @@
+#ifndef RIR_ANALYSIS_TYPES_H
+#define RIR_ANALYSIS_TYPES_H
+
+#include "R/r.h"
+#include "analysis_framework/analysis.h"
+#include "analysis_framework/dispatchers.h"
+#include "ir/CodeEditor.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+
+namespace rir {
+
+/*
+ *                         Any
+ *                          |
+ *                        Plain
+ *                 /     |     \     \
+ *               Lgl    Int    Real   IntSeq
+ *                 \     |     /     /
+ *                       Bottom
+ *
+ * Lgl, Int and Real are simple scalars (length one, no attributes) of that
+ * type, NA included. IntSeq is an integer vector without attributes, as
+ * returned by : and seq_len. Plain is any atomic vector which is not an
+ * object, operations on it do not dispatch. Values pushed by push_ remember
+ * their constant.
+ *
+ * Int also has a range, IntSeq the range of its elements. NA_INTEGER is
+ * INT_MIN, a range which includes it means the value might be NA.
+ */
+class TValue {
+  public:
+    enum class Type { Bottom, Lgl, Int, Real, IntSeq, Plain, Any };
+
+    Type t = Type::Bottom;
+    SEXP constant = nullptr;
+    int64_t lo = INT_MIN;
+    int64_t hi = INT_MAX;
+
+    TValue() {}
+    TValue(Type t, SEXP constant = nullptr) : t(t), constant(constant) {}
+    TValue(Type t, int64_t lo, int64_t hi, SEXP constant = nullptr)
+        : t(t), constant(constant), lo(lo), hi(hi) {
+        // the bounds are computed in 64 bit, the result wrapped around
+        if (lo < -INT_MAX || hi > INT_MAX || lo > hi) {
+            this->lo = INT_MIN;
+            this->hi = INT_MAX;
+        }
+    }
+
+    static TValue Lgl() { return TValue(Type::Lgl); }
+    static TValue Int(int64_t lo = INT_MIN, int64_t hi = INT_MAX) {
+        return TValue(Type::Int, lo, hi);
+    }
+    static TValue Real() { return TValue(Type::Real); }
+    static TValue IntSeq(int64_t lo = INT_MIN, int64_t hi = INT_MAX) {
+        return TValue(Type::IntSeq, lo, hi);
+    }
+    static TValue Plain() { return TValue(Type::Plain); }
+    static TValue Any() { return TValue(Type::Any); }
+    static TValue Absent() { return TValue(Type::Any); }
+    static const TValue& top() {
+        static TValue val = TValue(Type::Any);
+        return val;
+    }
+
+    static TValue of(SEXP c) {
+        if (XLENGTH(c) == 1 && ATTRIB(c) == R_NilValue) {
+            switch (TYPEOF(c)) {
+            case LGLSXP:
+                return TValue(Type::Lgl, c);
+            case INTSXP:
+                return TValue(Type::Int, INTEGER(c)[0], INTEGER(c)[0], c);
+            case REALSXP:
+                return TValue(Type::Real, c);
+            default:
+                break;
+            }
+        }
+        if (isVectorAtomic(c) && !OBJECT(c))
+            return TValue(Type::Plain, c);
+        return TValue(Type::Any, c);
+    }
+
+    bool isScalar() const {
+        return t == Type::Lgl || t == Type::Int || t == Type::Real;
+    }
+
+    bool isNumber() const { return t == Type::Int || t == Type::Real; }
+
+    bool isPlain() const {
+        return isScalar() || t == Type::IntSeq || t == Type::Plain;
+    }
+
+    bool maybeNA() const { return lo == INT_MIN; }
+
+    /** The range of an integer, or of a whole number constant.
+     */
+    bool bounds(int64_t& l, int64_t& h) const {
+        if (t == Type::Int) {
+            l = lo;
+            h = hi;
+            return true;
+        }
+        if (!isWholeNumber())
+            return false;
+        l = h = (int64_t)REAL(constant)[0];
+        return true;
+    }
+
+    /** A constant which is a whole number in the int range, : treats it like
+     * an integer.
+     */
+    bool isWholeNumber() const {
+        if (t == Type::Int)
+            return true;
+        if (t != Type::Real || !constant)
+            return false;
+        double v = REAL(constant)[0];
+        return R_FINITE(v) && v == std::floor(v) && v >= -INT_MAX &&
+               v <= INT_MAX;
+    }
+
+    bool operator==(TValue const& other) const {
+        return t == other.t && constant == other.constant && lo == other.lo &&
+               hi == other.hi;
+    }
+
+    bool mergeWith(TValue const& other) {
+        if (*this == other || t == Type::Any || other.t == Type::Bottom)
+            return false;
+        if (t == Type::Bottom) {
+            *this = other;
+            return true;
+        }
+        if (t != other.t) {
+            Type merged =
+                isPlain() && other.isPlain() ? Type::Plain : Type::Any;
+            if (t == merged)
+                return false;
+            *this = TValue(merged);
+            return true;
+        }
+        TValue old = *this;
+        constant = nullptr;
+        // A bound which grows goes to the limit right away, otherwise a loop
+        // counting up would take as many iterations to reach the fixpoint
+        if (other.lo < lo)
+            lo = other.lo == INT_MIN ? INT_MIN : -INT_MAX;
+        if (other.hi > hi)
+            hi = INT_MAX;
+        return !(*this == old);
+    }
+
+    void print() const {
+        switch (t) {
+        case Type::Bottom:
+            Rprintf("??");
+            break;
+        case Type::Lgl:
+            Rprintf("lgl");
+            break;
+        case Type::Int:
+            Rprintf("int");
+            break;
+        case Type::Real:
+            Rprintf("real");
+            break;
+        case Type::IntSeq:
+            Rprintf("int seq");
+            break;
+        case Type::Plain:
+            Rprintf("plain");
+            break;
+        case Type::Any:
+            Rprintf("Any");
+            break;
+        }
+        if ((t == Type::Int || t == Type::IntSeq) &&
+            (lo != INT_MIN || hi != INT_MAX))
+            Rprintf(" [%lld, %lld]", (long long)lo, (long long)hi);
+        if (constant)
+            Rprintf(" (const)");
+    }
+};
+
+// Like in the dataflow analysis, once the environment is leaked any code we
+// do not know may change the local variables
+class TGlobal {
+  public:
+    bool leaksEnvironment = false;
+    bool mergeWith(const TGlobal* other) {
+        if (!leaksEnvironment && other->leaksEnvironment) {
+            leaksEnvironment = true;
+            return true;
+        }
+        return false;
+    }
+};
+
+/** Infers the types of stack values and local variables where they are
+ * known to be simple scalars, integer sequences or plain vectors.
+ *
+ * Types only come from constants and from instructions whose result type is
+ * fixed by the types of their operands. A local variable keeps its type until
+ * it is stored to, or until code runs which could change it: calls to
+ * anything but safe builtins and, once the environment leaked, forcing
+ * promises. Arithmetic, comparisons and builtins which only dispatch on
+ * objects cannot run foreign code on plain vectors.
+ *
+ * This makes leaksEnvironment a more precise leak model than the one of the
+ * conservative dataflow analysis.
+ */
+class TypeAnalysis
+    : public ForwardAnalysisIns<AbstractState<SEXP, TValue, TGlobal>>,
+      public InstructionDispatcher::Receiver {
+
+  public:
+    typedef TValue::Type T;
+
+    TypeAnalysis() : dispatcher_(*this) {}
+
+    /** The integer result of lhs op rhs, for +, - and *. Its range is only
+     * known if neither operand can be NA, if it does not fit the result
+     * might be NA as well.
+     */
+    static TValue intArith(Opcode op, TValue lhs, TValue rhs) {
+        if (lhs.t != T::Int || rhs.t != T::Int || lhs.maybeNA() ||
+            rhs.maybeNA())
+            return TValue::Int();
+        switch (op) {
+        case Opcode::add_:
+        case Opcode::add_int_:
+        case Opcode::add_int_unchecked_:
+            return TValue::Int(lhs.lo + rhs.lo, lhs.hi + rhs.hi);
+        case Opcode::sub_:
+        case Opcode::sub_int_:
+        case Opcode::sub_int_unchecked_:
+            return TValue::Int(lhs.lo - rhs.hi, lhs.hi - rhs.lo);
+        case Opcode::mul_:
+        case Opcode::mul_int_:
+        case Opcode::mul_int_unchecked_: {
+            int64_t p[] = {lhs.lo * rhs.lo, lhs.lo * rhs.hi, lhs.hi * rhs.lo,
+                           lhs.hi * rhs.hi};
+            return TValue::Int(*std::min_element(p, p + 4),
+                               *std::max_element(p, p + 4));
+        }
+        default:
+            return TValue::Int();
+        }
+    }
+
+  protected:
+
+    virtual Dispatcher& dispatcher() override { return dispatcher_; }
+
+    AbstractState<SEXP, TValue, TGlobal>* initialState() override {
+        auto* result = new AbstractState<SEXP, TValue, TGlobal>();
+        for (auto a : code_->arguments()) {
+            (*result)[a.first] = TValue::Any();
+            if (a.second != R_MissingArg &&
+                (TYPEOF(a.second) == LANGSXP || TYPEOF(a.second) == SYMSXP))
+                result->global().leaksEnvironment = true;
+        }
+        return result;
+    }
+
+    void doCall() {
+        current().global().leaksEnvironment = true;
+        current().mergeAllEnv(TValue::Any());
+    }
+
+    void load(CodeEditor::Iterator ins) {
+        SEXP sym = Pool::get((*ins).immediate.pool);
+        TValue v = current()[sym];
+        // Anything else might be a promise
+        if (v.t == T::Any && current().global().leaksEnvironment)
+            doCall();
+        current().push(v);
+    }
+
+    void ldvar_(CodeEditor::Iterator ins) override { load(ins); }
+    void ldddvar_(CodeEditor::Iterator ins) override { load(ins); }
+    void ldarg_(CodeEditor::Iterator ins) override { load(ins); }
+
+    void ldlval_(CodeEditor::Iterator ins) override {
+        SEXP sym = Pool::get((*ins).immediate.pool);
+        current().push(current()[sym]);
+    }
+
+    void ldfun_(CodeEditor::Iterator ins) override {
+        if (current().global().leaksEnvironment)
+            doCall();
+        current().push(TValue::Any());
+    }
+
+    void force_(CodeEditor::Iterator ins) override {
+        if (current().top().t == T::Any && current().global().leaksEnvironment)
+            doCall();
+    }
+
+    void stvar_(CodeEditor::Iterator ins) override {
+        SEXP sym = Pool::get((*ins).immediate.pool);
+        current()[sym] = current().pop();
+    }
+
+    void clear_(CodeEditor::Iterator ins) override {
+        SEXP sym = Pool::get((*ins).immediate.pool);
+        current()[sym] = TValue::Any();
+    }
+
+    void push_(CodeEditor::Iterator ins) override {
+        current().push(TValue::of((*ins).immediateConst()));
+    }
+
+    void promise_(CodeEditor::Iterator ins) override {
+        current().global().leaksEnvironment = true;
+        current().push(TValue::Any());
+    }
+
+    void push_code_(CodeEditor::Iterator ins) override {
+        current().global().leaksEnvironment = true;
+        current().push(TValue::Any());
+    }
+
+    void close_(CodeEditor::Iterator ins) override {
+        current().pop(3);
+        current().global().leaksEnvironment = true;
+        current().push(TValue::Any());
+    }
+
+    void dup_(CodeEditor::Iterator ins) override {
+        current().push(current().top());
+    }
+
+    void dup2_(CodeEditor::Iterator ins) override {
+        TValue a = current().stack()[1];
+        TValue b = current().stack()[0];
+        current().push(a);
+        current().push(b);
+    }
+
+    void swap_(CodeEditor::Iterator ins) override {
+        TValue a = current().pop();
+        TValue b = current().pop();
+        current().push(a);
+        current().push(b);
+    }
+
+    void pick_(CodeEditor::Iterator ins) override {
+        int n = (*ins).immediate.i;
+        TValue v = current()[n];
+        for (int i = n; i > 0; --i)
+            current()[i] = current()[i - 1];
+        current().top() = v;
+    }
+
+    void put_(CodeEditor::Iterator ins) override {
+        int n = (*ins).immediate.i;
+        TValue v = current().top();
+        for (int i = 0; i < n; ++i)
+            current()[i] = current()[i + 1];
+        current()[n] = v;
+    }
+
+    void pull_(CodeEditor::Iterator ins) override {
+        int n = (*ins).immediate.i;
+        TValue v = current()[n];
+        current().push(v);
+    }
+
+    // the counter of the for loop starts at 0 and is incremented, it is no
+    // NA. The element extracted with it comes from the range of the sequence
+    void for_step_(CodeEditor::Iterator ins) override {
+        current().top() = TValue::Int(1, INT_MAX);
+    }
+
+    void set_shared_(CodeEditor::Iterator ins) override {}
+    void make_unique_(CodeEditor::Iterator ins) override {}
+    void brobj_(CodeEditor::Iterator ins) override {}
+
+    void call_(CodeEditor::Iterator ins) override {
+        current().pop();
+        doCall();
+        current().push(TValue::Any());
+    }
+
+    void dispatch_(CodeEditor::Iterator ins) override {
+        current().pop();
+        doCall();
+        current().push(TValue::Any());
+    }
+
+    void dispatch_stack_(CodeEditor::Iterator ins) override {
+        current().pop((*ins).immediate.call_args.nargs);
+        doCall();
+        current().push(TValue::Any());
+    }
+
+    /** Builtins which run foreign code only by dispatching on an object
+     * argument.
+     */
+    static bool dispatchesOnObjects(SEXP fun) {
+        static const char* names[] = {"%*%",  "abs",  "exp",     "length",
+                                      "max",  "min",  "prod",    "seq_along",
+                                      "sqrt", "sum",  "seq_len"};
+        static const size_t count = sizeof(names) / sizeof(names[0]);
+        static SEXP builtins[count] = {};
+        if (!builtins[0])
+            for (size_t i = 0; i < count; ++i)
+                builtins[i] = Rf_install(names[i])->u.symsxp.value;
+        for (auto b : builtins)
+            if (fun == b)
+                return true;
+        return false;
+    }
+
+    /** A safe builtin cannot touch the environment, unless forcing one of
+     * its arguments does. Neither can one which only dispatches on objects,
+     * if all arguments are plain.
+     */
+    void builtinCall(SEXP fun, TValue arg, bool plainArgs) {
+        bool safe = (TYPEOF(fun) == BUILTINSXP || TYPEOF(fun) == SPECIALSXP) &&
+                    isSafeBuiltin(fun->u.primsxp.offset);
+        bool plain = plainArgs && dispatchesOnObjects(fun);
+        if ((!safe && !plain) || current().global().leaksEnvironment)
+            doCall();
+        static SEXP seqLen = nullptr;
+        static SEXP seqAlong = nullptr;
+        if (!seqLen) {
+            seqLen = Rf_install("seq_len")->u.symsxp.value;
+            seqAlong = Rf_install("seq_along")->u.symsxp.value;
+        }
+        if (fun == seqLen) {
+            int64_t lo, hi;
+            if (!arg.bounds(lo, hi) || hi < 1)
+                hi = INT_MAX;
+            current().push(TValue::IntSeq(1, hi));
+        } else if (fun == seqAlong) {
+            current().push(TValue::IntSeq(1, INT_MAX));
+        } else if (plain) {
+            current().push(TValue::Plain());
+        } else {
+            current().push(TValue::Any());
+        }
+    }
+
+    bool plainArgs(size_t nargs) {
+        for (size_t i = 0; i < nargs; ++i)
+            if (!current().stack()[i].isPlain())
+                return false;
+        return true;
+    }
+
+    void call_stack_(CodeEditor::Iterator ins) override {
+        size_t nargs = (*ins).immediate.call_args.nargs;
+        TValue arg = nargs == 1 ? current().top() : TValue::Any();
+        bool plain = plainArgs(nargs);
+        current().pop(nargs);
+        current().pop();
+        CallSite* cs = ins.callSite();
+        builtinCall(cs->hasTarget ? Pool::get(*cs->target()) : R_NilValue,
+                    arg, plain);
+    }
+
+    void static_call_stack_(CodeEditor::Iterator ins) override {
+        size_t nargs = (*ins).immediate.call_args.nargs;
+        TValue arg = nargs == 1 ? current().top() : TValue::Any();
+        bool plain = plainArgs(nargs);
+        current().pop(nargs);
+        builtinCall(Pool::get(*ins.callSite()->target()), arg, plain);
+    }
+
+    void return_(CodeEditor::Iterator ins) override {
+        current().pop(current().stack().depth());
+    }
+
+    void label(CodeEditor::Iterator ins) override {}
+
+    /** The type of lhs op rhs for simple scalars, R promotes to the larger
+     * of the two and logicals to integers.
+     */
+    static TValue arith(Opcode op, TValue lhs, TValue rhs) {
+        if (op == Opcode::div_ || op == Opcode::pow_)
+            return TValue::Real();
+        if (lhs.t == T::Real || rhs.t == T::Real)
+            return TValue::Real();
+        return intArith(op, lhs, rhs);
+    }
+
+    void any(CodeEditor::Iterator ins) override {
+        BC bc = *ins;
+        switch (bc.bc) {
+        case Opcode::add_int_:
+        case Opcode::sub_int_:
+        case Opcode::mul_int_:
+        case Opcode::add_int_unchecked_:
+        case Opcode::sub_int_unchecked_:
+        case Opcode::mul_int_unchecked_: {
+            TValue rhs = current().pop();
+            TValue lhs = current().pop();
+            current().push(intArith(bc.bc, lhs, rhs));
+            return;
+        }
+
+        case Opcode::add_real_:
+        case Opcode::sub_real_:
+        case Opcode::mul_real_:
+        case Opcode::div_real_:
+            current().pop(2);
+            current().push(TValue::Real());
+            return;
+
+        case Opcode::add_:
+        case Opcode::sub_:
+        case Opcode::mul_:
+        case Opcode::div_:
+        case Opcode::pow_:
+        case Opcode::idiv_:
+        case Opcode::mod_: {
+            TValue rhs = current().pop();
+            TValue lhs = current().pop();
+            if (lhs.isScalar() && rhs.isScalar()) {
+                current().push(arith(bc.bc, lhs, rhs));
+            } else if (lhs.isPlain() && rhs.isPlain()) {
+                current().push(TValue::Plain());
+            } else {
+                doCall();
+                current().push(TValue::Any());
+            }
+            return;
+        }
+
+        case Opcode::uplus_:
+        case Opcode::uminus_: {
+            TValue v = current().pop();
+            if (v.t == T::Int && !v.maybeNA()) {
+                if (bc.is(Opcode::uminus_))
+                    current().push(TValue::Int(-v.hi, -v.lo));
+                else
+                    current().push(TValue::Int(v.lo, v.hi));
+            } else if (v.isScalar()) {
+                current().push(v.t == T::Real ? TValue::Real() : TValue::Int());
+            } else if (v.isPlain()) {
+                current().push(TValue::Plain());
+            } else {
+                doCall();
+                current().push(TValue::Any());
+            }
+            return;
+        }
+
+        case Opcode::lt_:
+        case Opcode::gt_:
+        case Opcode::le_:
+        case Opcode::ge_:
+        case Opcode::eq_:
+        case Opcode::ne_: {
+            TValue rhs = current().pop();
+            TValue lhs = current().pop();
+            if (lhs.isScalar() && rhs.isScalar()) {
+                current().push(TValue::Lgl());
+            } else if (lhs.isPlain() && rhs.isPlain()) {
+                current().push(TValue::Plain());
+            } else {
+                doCall();
+                current().push(TValue::Any());
+            }
+            return;
+        }
+
+        case Opcode::not_: {
+            TValue v = current().pop();
+            if (v.isScalar()) {
+                current().push(TValue::Lgl());
+            } else if (v.isPlain()) {
+                current().push(TValue::Plain());
+            } else {
+                doCall();
+                current().push(TValue::Any());
+            }
+            return;
+        }
+
+        // always a single logical, or an error
+        case Opcode::asbool_:
+        case Opcode::aslogical_:
+            if (!current().pop().isPlain())
+                doCall();
+            current().push(TValue::Lgl());
+            return;
+
+        case Opcode::is_:
+        case Opcode::isfun_:
+            current().pop();
+            current().push(TValue::Lgl());
+            return;
+
+        // does not check for overflow
+        case Opcode::inc_: {
+            TValue v = current().pop();
+            if (v.t == T::Int && !v.maybeNA() && v.hi < INT_MAX)
+                current().push(TValue::Int(v.lo + 1, v.hi + 1));
+            else
+                current().push(TValue::Int());
+            return;
+        }
+
+        case Opcode::extract1_:
+        case Opcode::extract1_unchecked_: {
+            TValue idx = current().pop();
+            TValue vec = current().pop();
+            // an NA index gives NA
+            bool naIdx = idx.t == T::Int ? idx.maybeNA() : !idx.isWholeNumber();
+            if (vec.t == T::IntSeq && idx.isNumber()) {
+                current().push(naIdx ? TValue::Int()
+                                     : TValue::Int(vec.lo, vec.hi));
+            } else if (vec.isScalar() && idx.isNumber()) {
+                if (vec.t == T::Int && naIdx)
+                    vec = TValue::Int();
+                vec.constant = nullptr;
+                current().push(vec);
+            } else if (vec.isPlain() && idx.isNumber()) {
+                current().push(TValue::Plain());
+            } else {
+                current().push(TValue::Any());
+            }
+            return;
+        }
+
+        // : coerces its arguments without dispatching
+        case Opcode::colon_: {
+            TValue to = current().pop();
+            TValue from = current().pop();
+            int64_t fromLo, fromHi, toLo, toHi;
+            if (from.bounds(fromLo, fromHi) && to.bounds(toLo, toHi)) {
+                // the elements lie between from and to, NA is an error
+                current().push(TValue::IntSeq(
+                    std::max<int64_t>(std::min(fromLo, toLo), -INT_MAX),
+                    std::max(fromHi, toHi)));
+            } else {
+                current().push(TValue::Plain());
+            }
+            return;
+        }
+
+        default:
+            break;
+        }
+
+        if (bc.isRelopJmp()) {
+            TValue rhs = current().pop();
+            TValue lhs = current().pop();
+            if (!lhs.isPlain() || !rhs.isPlain())
+                doCall();
+            return;
+        }
+
+        current().pop(bc.popCount());
+        if (!bc.isPure())
+            doCall();
+        for (size_t i = 0, e = bc.pushCount(); i != e; ++i)
+            current().push(TValue::Any());
+    }
+
+    InstructionDispatcher dispatcher_;
+};
+}
+#endif
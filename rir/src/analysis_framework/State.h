@@ -2,8 +2,8 @@
 
 #include <algorithm>
 #include <cstdlib>
-#include <deque>
-#include <map>
+#include <utility>
+#include <vector>
 
 #include "R/r.h"
 #include "ir/CodeEditor.h"
@@ -56,6 +56,9 @@ class has_mergeWith {
   Model of an abstract stack is relatively easy - since for correct code, stack
   depth at any mergepoints must be constant, so stack merging is only a merge of
   the stack's values.
+
+  The values are kept in a vector with the top of the stack at its back, so
+  that copying a stack is a single allocation.
  */
 template <typename AVALUE>
 class AbstractStack : public State {
@@ -99,15 +102,15 @@ class AbstractStack : public State {
 
     /** Returns the top value of the stack.
      */
-    AVALUE& top() { return stack_.front(); }
+    AVALUE& top() { return stack_.back(); }
 
-    AVALUE const& top() const { return stack_.front(); }
+    AVALUE const& top() const { return stack_.back(); }
 
     /** Removes the top value from the stack.
      */
     AVALUE pop() {
-        AVALUE result = stack_.front();
-        stack_.pop_front();
+        AVALUE result = stack_.back();
+        stack_.pop_back();
         return result;
     }
 
@@ -115,13 +118,12 @@ class AbstractStack : public State {
      */
     void pop(size_t num) {
         assert(stack_.size() >= num);
-        for (size_t i = 0; i != num; ++i)
-            stack_.pop_front();
+        stack_.resize(stack_.size() - num);
     }
 
     /** Pushes new value on the stack.
      */
-    void push(AVALUE value) { stack_.push_front(value); }
+    void push(AVALUE value) { stack_.push_back(value); }
 
     /** Returns the depth of the stack.
      */
@@ -135,12 +137,12 @@ class AbstractStack : public State {
      */
     AVALUE const& operator[](size_t idx) const {
         assert(idx < stack_.size());
-        return stack_[idx];
+        return stack_[stack_.size() - 1 - idx];
     }
 
     AVALUE& operator[](size_t idx) {
         assert(idx < stack_.size());
-        return stack_[idx];
+        return stack_[stack_.size() - 1 - idx];
     }
 
     /** Prettyprints the stack.
@@ -149,29 +151,32 @@ class AbstractStack : public State {
         Rprintf("Stack depth: %i\n", stack_.size());
         for (size_t i = 0; i < stack_.size(); ++i) {
             Rprintf("  %i : ", i);
-            stack_[i].print();
+            (*this)[i].print();
             Rprintf("\n");
         }
     }
 
-    /** Provides begin and end methods so that we easily iterate over the abstract stack's values.
+    /** Provides begin and end methods so that we easily iterate over the abstract stack's values (starting at the top).
      */
-    typename std::deque<AVALUE>::const_iterator const begin() const {
-        return stack_.begin();
+    typename std::vector<AVALUE>::const_reverse_iterator begin() const {
+        return stack_.rbegin();
     }
 
-    typename std::deque<AVALUE>::const_iterator const end() const {
-        return stack_.end();
+    typename std::vector<AVALUE>::const_reverse_iterator end() const {
+        return stack_.rend();
     }
 
   protected:
-    // the actual stack
-    std::deque<AVALUE> stack_;
+    // the actual stack, top is the last element
+    std::vector<AVALUE> stack_;
 };
 
 /** Abstract environment.
 
-    The abstract environment is implemented as a hashmap with templated keys and values.
+    The abstract environment is implemented as a vector of bindings sorted by
+    their keys. Environments of R functions are small, so lookups by binary
+    search are cheap, copying is a single allocation and two environments can
+    be merged in one pass.
   */
 template <typename KEY, typename AVALUE>
 class AbstractEnvironment : public State {
@@ -184,6 +189,7 @@ class AbstractEnvironment : public State {
   public:
     // shorthand typedef
     typedef AVALUE Value;
+    typedef std::pair<KEY, AVALUE> Binding;
 
     /** Creates an abstract environment with no parent.
      */
@@ -223,27 +229,44 @@ class AbstractEnvironment : public State {
     bool mergeWith(AbstractEnvironment const& other) {
         bool result = false;
 
-        for (auto i = other.env_.begin(), e = other.env_.end(); i != e; ++i) {
-            auto own = env_.find(i->first);
-            if (own == env_.end()) {
-                // if there is a variable in other that does not exist here, we
-                // merge it with the Absent value.
-                AVALUE missing = i->second;
-                missing.mergeWith(AVALUE::Absent());
-                env_.emplace(i->first, missing);
-                result = true;
-            } else {
-                // otherwise try merging it with our variable
-                result = own->second.mergeWith(i->second) or result;
-            }
-        }
-        for (auto i = env_.begin(), e = env_.end(); i != e; ++i) {
-            auto them = other.env_.find(i->first);
-            if (them == other.env_.end()) {
-                // The other env has is missing this value, we must treat this
-                // as absent
-                result = i->second.mergeWith(AVALUE::Absent()) or result;
+        bool sameKeys =
+            env_.size() == other.env_.size() &&
+            std::equal(env_.begin(), env_.end(), other.env_.begin(),
+                       [](Binding const& a, Binding const& b) {
+                           return a.first == b.first;
+                       });
+        if (sameKeys) {
+            for (size_t i = 0, e = env_.size(); i != e; ++i)
+                result = env_[i].second.mergeWith(other.env_[i].second) or
+                         result;
+        } else {
+            // both are sorted, merge them in one pass
+            std::vector<Binding> merged;
+            merged.reserve(env_.size() + other.env_.size());
+            auto i = env_.begin(), ie = env_.end();
+            auto j = other.env_.begin(), je = other.env_.end();
+            while (i != ie || j != je) {
+                if (j == je || (i != ie && i->first < j->first)) {
+                    // The other env has is missing this value, we must treat
+                    // this as absent
+                    result = i->second.mergeWith(AVALUE::Absent()) or result;
+                    merged.push_back(*i++);
+                } else if (i == ie || j->first < i->first) {
+                    // if there is a variable in other that does not exist
+                    // here, we merge it with the Absent value.
+                    AVALUE missing = j->second;
+                    missing.mergeWith(AVALUE::Absent());
+                    merged.push_back(Binding(j->first, missing));
+                    result = true;
+                    ++j;
+                } else {
+                    // otherwise try merging it with our variable
+                    result = i->second.mergeWith(j->second) or result;
+                    merged.push_back(*i++);
+                    ++j;
+                }
             }
+            env_.swap(merged);
         }
 
         // merge parents
@@ -265,7 +288,7 @@ class AbstractEnvironment : public State {
 
     /** Returns true if the environment contains given key, disregarding its parents.
      */
-    bool has(KEY name) const { return env_.find(name) != env_.end(); }
+    bool has(KEY name) const { return lookup(name) != env_.end(); }
 
     /** Simulates looking for a variable.
 
@@ -274,7 +297,7 @@ class AbstractEnvironment : public State {
       found anywhere in them, top value is returned.
      */
     AVALUE const& find(KEY name) const {
-        auto i = env_.find(name);
+        auto i = lookup(name);
         if (i == env_.end())
             if (parent_ != nullptr)
                 return parent_->find(name);
@@ -287,7 +310,7 @@ class AbstractEnvironment : public State {
     /** The [] operator is defined as a shorthand for the find() method.
      */
     AVALUE const& operator[](KEY name) const {
-        auto i = env_.find(name);
+        auto i = lookup(name);
         if (i == env_.end())
             return AVALUE::top();
         else
@@ -295,15 +318,12 @@ class AbstractEnvironment : public State {
     }
 
     AVALUE& operator[](KEY name) {
-        auto i = env_.find(name);
-        if (i == env_.end()) {
+        auto i = position(name);
+        if (i == env_.end() || i->first != name) {
             // so that we do not demand default constructor on values
-            env_.insert(std::pair<KEY, AVALUE>(name, AVALUE::top()));
-            i = env_.find(name);
-            return i->second;
-        } else {
-            return i->second;
+            i = env_.insert(i, Binding(name, AVALUE::top()));
         }
+        return i->second;
     }
 
     /** Returns true if the environment has a parent environment specified.
@@ -343,18 +363,37 @@ class AbstractEnvironment : public State {
 
     /** Iterators to support the for each statement in a way identical to C+_ maps.
      */
-    typename std::map<KEY, AVALUE>::iterator begin() { return env_.begin(); }
+    typename std::vector<Binding>::iterator begin() { return env_.begin(); }
 
-    typename std::map<KEY, AVALUE>::iterator end() { return env_.end(); }
+    typename std::vector<Binding>::iterator end() { return env_.end(); }
 
   protected:
+    /** Returns the first binding whose key is not smaller than name.
+     */
+    typename std::vector<Binding>::iterator position(KEY name) {
+        return std::lower_bound(
+            env_.begin(), env_.end(), name,
+            [](Binding const& b, KEY name) { return b.first < name; });
+    }
+
+    /** Returns the binding of name, or end().
+     */
+    typename std::vector<Binding>::const_iterator lookup(KEY name) const {
+        auto i = std::lower_bound(
+            env_.begin(), env_.end(), name,
+            [](Binding const& b, KEY name) { return b.first < name; });
+        if (i != env_.end() && i->first == name)
+            return i;
+        return env_.end();
+    }
+
     /** The parent environment.
      */
     AbstractEnvironment* parent_ = nullptr;
 
-    /** The underlying map of keys and values directly stored in this environment.
+    /** The bindings directly stored in this environment, sorted by key.
      */
-    std::map<KEY, AVALUE> env_;
+    std::vector<Binding> env_;
 };
 
 /** Dummy state which can be used as a placeholder when an empty state is required.
@@ -4,6 +4,13 @@
 #include "framework.h"
 
 #include "R/Funtab.h"
+
+#include <deque>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
 namespace rir {
 
 /** Base class for all analyses.
@@ -76,8 +83,8 @@ class ForwardAnalysis : public Analysis {
         initialState_ = nullptr;
         currentState_ = nullptr;
         finalState_ = nullptr;
-        for (auto& s : mergePoints_)
-            delete s.second;
+        for (auto s : mergePoints_)
+            delete s;
         mergePoints_.clear();
     }
 
@@ -107,70 +114,71 @@ class ForwardAnalysis : public Analysis {
     virtual ASTATE* initialState() { return new ASTATE(); }
 
     /** Prforms the analysis itself using the forrward pass algorithm.
+
+        The code is split into blocks at labels, and blocks are visited in
+        reverse postorder, such that (except for loop back edges) all
+        predecessors of a block are merged before it is analyzed.
      */
     void doAnalyze() override {
         initialState_ = initialState();
-        currentState_ = initialState_->clone();
-        q_.push_front(code_->begin());
+        mergePoints_.assign(code_->numLabels(), nullptr);
+        computeOrder();
         Dispatcher& d = dispatcher();
+
+        if (code_->isLabel(code_->begin())) {
+            currentState_ = initialState_->clone();
+            mergeInto(code_->begin());
+        } else {
+            enqueue(0);
+        }
+
         while (not q_.empty()) {
-            currentIns_ = q_.front();
-            q_.pop_front();
+            size_t block = order_[q_.top()];
+            q_.pop();
+            queued_[block] = false;
+            currentIns_ = start_[block];
+            if (block == 0)
+                currentState_ = initialState_->clone();
+            else
+                currentState_ = mergePoints_[block - 1]->clone();
             while (true) {
-                // if current instruction is label, deal with state merging
-                if (code_->isLabel(currentIns_)) {
-                    // if state not stored, store copy of incoming
-                    State*& stored = mergePoints_[currentIns_];
-                    if (stored == nullptr) {
-                        assert(currentState_ != nullptr);
-                        stored = currentState_->clone();
-                    } else {
-                        // if incoming not present, copy stored
-                        if (currentState_ == nullptr) {
-                            currentState_ = stored->clone();
-                            // otherwise merge incoming with stored
-                        } else if (stored->mergeWith(currentState_)) {
-                            delete currentState_;
-                            currentState_ = stored->clone();
-                            // and terminate current branch if there is no need
-                            // to continue
-                        } else {
-                            delete currentState_;
-                            currentState_ = nullptr;
-                            break;
-                        }
-                    }
-                }
                 // user dispatch method
                 d.dispatch(currentIns_);
 
                 if (code_->isJmp(currentIns_)) {
-                    auto l = code_->target(currentIns_);
-                    if (shouldJump(l)) {
-                        q_.push_front(l);
-                    }
-                    if (code_->isUncondJmp(currentIns_)) {
-                        delete currentState_;
-                        currentState_ = nullptr;
+                    mergeInto(code_->target(currentIns_));
+                    if (code_->isUncondJmp(currentIns_))
                         break;
-                    }
                 } else if (code_->isExitPoint(currentIns_)) {
                     if (finalState_ == nullptr) {
                         finalState_ = currentState_;
+                        currentState_ = nullptr;
                     } else {
                         finalState_->mergeWith(currentState_);
-                        delete currentState_;
                     }
-                    currentState_ = nullptr;
                     break;
                 }
 
-                // move to next instruction
+                // move to next instruction, a label starts a new block
                 ++currentIns_;
+                if (code_->isLabel(currentIns_)) {
+                    mergeInto(currentIns_);
+                    break;
+                }
             }
+            delete currentState_;
+            currentState_ = nullptr;
         }
     }
 
+    /** Returns the state stored at the given label, or nullptr if the label
+        is not reachable.
+     */
+    State* mergeState(CodeEditor::Iterator label) {
+        assert(code_->isLabel(label));
+        return mergePoints_[(*label).immediate.offset];
+    }
+
     // initial state
     State* initialState_ = nullptr;
     // current state
@@ -179,24 +187,94 @@ class ForwardAnalysis : public Analysis {
     State* finalState_ = nullptr;
     // current instruction the analysis operates on
     CodeEditor::Iterator currentIns_;
-    // map of states at mergepoints in the analyzed code
-    std::unordered_map<CodeEditor::Iterator, State*> mergePoints_;
+    // states at mergepoints in the analyzed code, indexed by label
+    std::vector<State*> mergePoints_;
 
   private:
-    /** When faced with a jump, determinesd whether the jump should be taken, or not based on whether the state at the target mergepoint would change or not.
+    /** Merges the current state into the state of the given label and
+        schedules the label's block if the stored state changed.
      */
-    bool shouldJump(CodeEditor::Iterator label) {
-        State*& stored = mergePoints_[label];
-        if (stored == nullptr) {
+    void mergeInto(CodeEditor::Iterator label) {
+        size_t l = (*label).immediate.offset;
+        State*& stored = mergePoints_[l];
+        if (stored == nullptr)
             stored = currentState_->clone();
-            return true;
+        else if (!stored->mergeWith(currentState_))
+            return;
+        enqueue(l + 1);
+    }
+
+    void enqueue(size_t block) {
+        if (queued_[block])
+            return;
+        queued_[block] = true;
+        q_.push(rpo_[block]);
+    }
+
+    /** Numbers the blocks in reverse postorder. Block 0 starts at the entry,
+        block l + 1 at label l.
+     */
+    void computeOrder() {
+        size_t blocks = code_->numLabels() + 1;
+        std::vector<std::vector<size_t>> succ(blocks);
+        start_.assign(blocks, code_->end());
+        start_[0] = code_->begin();
+        size_t cur = 0;
+        bool fallthrough = true;
+        for (auto i = code_->begin(); i != code_->end(); ++i) {
+            if (code_->isLabel(i)) {
+                size_t next = (*i).immediate.offset + 1;
+                if (fallthrough)
+                    succ[cur].push_back(next);
+                start_[next] = i;
+                cur = next;
+            }
+            fallthrough = true;
+            if (code_->isJmp(i)) {
+                succ[cur].push_back((*i).immediate.offset + 1);
+                fallthrough = !code_->isUncondJmp(i);
+            } else if (code_->isExitPoint(i)) {
+                fallthrough = false;
+            }
         }
-        return stored->mergeWith(currentState_);
+
+        // iterative depth first search for the postorder
+        std::vector<size_t> postorder;
+        std::vector<bool> visited(blocks, false);
+        std::vector<std::pair<size_t, size_t>> stack;
+        stack.push_back({0, 0});
+        visited[0] = true;
+        while (!stack.empty()) {
+            auto& top = stack.back();
+            if (top.second < succ[top.first].size()) {
+                size_t next = succ[top.first][top.second++];
+                if (!visited[next]) {
+                    visited[next] = true;
+                    stack.push_back({next, 0});
+                }
+            } else {
+                postorder.push_back(top.first);
+                stack.pop_back();
+            }
+        }
+
+        rpo_.assign(blocks, 0);
+        order_.assign(postorder.rbegin(), postorder.rend());
+        for (size_t i = 0; i < order_.size(); ++i)
+            rpo_[order_[i]] = i;
+        queued_.assign(blocks, false);
     }
 
-    /** Queue of mergepoints to analyze. Merge points are identified by their code instructions.
+    /** First instruction, reverse postorder number of each block, and the
+        blocks in that order.
      */
-    std::deque<CodeEditor::Iterator> q_;
+    std::vector<CodeEditor::Iterator> start_;
+    std::vector<size_t> rpo_;
+    std::vector<size_t> order_;
+    /** Blocks to analyze, by reverse postorder number.
+     */
+    std::priority_queue<size_t, std::vector<size_t>, std::greater<size_t>> q_;
+    std::vector<bool> queued_;
 };
 /** Forward analysis which report the final state of the analysis.
 
@@ -216,6 +294,10 @@ class ForwardAnalysisFinal : public ForwardAnalysis<ASTATE> {
     ASTATE const& finalState() {
         return *reinterpret_cast<ASTATE*>(finalState_);
     }
+
+    /** Returns false if no exit point of the code is reachable.
+     */
+    bool hasFinalState() const { return finalState_ != nullptr; }
 };
 
 /** Forward analysis with abstract state for each instruction.
@@ -281,7 +363,7 @@ class ForwardAnalysisIns : public ForwardAnalysisFinal<ASTATE> {
         // if the cached instruction is label, dispose of the state and create a
         // copy of the fixpoint
         if (code_->isLabel(currentIns_)) {
-            auto fixpoint = mergePoints_[currentIns_];
+            auto fixpoint = this->mergeState(currentIns_);
             // if we reach dead code there is no merge state available
             if (fixpoint) {
                 delete currentState_;
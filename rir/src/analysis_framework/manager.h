@@ -0,0 +1,59 @@
+#pragma once
+
+#include "analysis.h"
+
+#include <memory>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+
+namespace rir {
+
+/** Caches the analyses of one CodeEditor.
+
+  Passes request analyses by their type. An analysis is only rerun if the
+  code was committed since it was last computed, so consecutive passes over
+  unchanged code share their results. Since commit() renumbers all
+  instructions, any committed edit invalidates every cached analysis, while a
+  commit without changes invalidates nothing.
+
+  Every CodeEditor owns a manager, see CodeEditor::analyses().
+ */
+class AnalysisManager {
+  public:
+    explicit AnalysisManager(CodeEditor& code) : code_(code) {}
+
+    /** Returns the analysis of type A, computed for the current code.
+
+      The returned object is owned by the manager and stays the same for the
+      lifetime of the editor, it is refreshed by subsequent calls to get().
+     */
+    template <typename A>
+    A& get() {
+        Entry& e = cache_[std::type_index(typeid(A))];
+        if (!e.analysis)
+            e.analysis.reset(new A());
+        if (!e.analysis->good() || e.version != code_.version()) {
+            e.analysis->analyze(code_);
+            e.version = code_.version();
+        }
+        return static_cast<A&>(*e.analysis);
+    }
+
+    /** Drops the results of all analyses.
+     */
+    void invalidate() {
+        for (auto& e : cache_)
+            e.second.analysis->invalidate();
+    }
+
+  private:
+    struct Entry {
+        std::unique_ptr<Analysis> analysis;
+        unsigned version = 0;
+    };
+
+    CodeEditor& code_;
+    std::unordered_map<std::type_index, Entry> cache_;
+};
+}
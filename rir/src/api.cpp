@@ -3,6 +3,9 @@
  */
 
 #include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
 
 #include "api.h"
 
@@ -10,12 +13,16 @@
 #include "interpreter/interp_context.h"
 #include "interpreter/interp.h"
 #include "ir/BC.h"
+#include "R/Protect.h"
+#include "R/Symbols.h"
 
 #include "analysis/Signature.h"
 #include "analysis/liveness.h"
 #include "analysis_framework/analysis.h"
 #include "optimization/cp.h"
+#include "utils/Image.h"
 #include "utils/Printer.h"
+#include "utils/Serializer.h"
 
 #include "ir/Optimizer.h"
 
@@ -48,6 +55,21 @@ REXPORT SEXP rir_compile(SEXP what, SEXP env = NULL) {
         if (TYPEOF(body) == EXTERNALSXP)
             Rf_error("closure already compiled");
 
+        // closures made portable by rir_portable carry their packed code
+        SEXP packed = Rf_getAttrib(what, symbol::rirPacked);
+        if (!Serializer::isPacked(packed) ||
+            !R_compute_identical(Serializer::body(packed), body, 16) ||
+            !R_compute_identical(Serializer::formals(packed), FORMALS(what),
+                                 16))
+            packed = Image::lookup(body, FORMALS(what));
+        if (packed) {
+            Protect p(packed);
+            SEXP result = Serializer::unpackClosure(packed, CLOENV(what));
+            Rf_copyMostAttrib(what, result);
+            Rf_setAttrib(result, symbol::rirPacked, R_NilValue);
+            return result;
+        }
+
         SEXP result = Compiler::compileClosure(body, FORMALS(what));
         SET_CLOENV(result, CLOENV(what));
         Rf_copyMostAttrib(what, result);
@@ -119,6 +141,50 @@ REXPORT SEXP rir_analysis_liveness(SEXP what) {
     return R_NilValue;
 }
 
+REXPORT SEXP rir_baseline(SEXP enable) {
+    SEXP old = Rf_ScalarLogical(Compiler::baseline);
+    if (enable != R_NilValue)
+        Compiler::baseline = Rf_asLogical(enable) == 1;
+    return old;
+}
+
+REXPORT SEXP rir_pack(SEXP what) {
+    SEXP res = Serializer::pack(what);
+    if (res == R_NilValue)
+        Rf_error("Not a rir compiled code");
+    return res;
+}
+
+REXPORT SEXP rir_portable(SEXP what) {
+    if (!isValidClosureSEXP(what))
+        Rf_error("Not a rir compiled closure");
+    Protect p;
+    SEXP packed = p(Serializer::pack(what));
+    SEXP result = p(allocSExp(CLOSXP));
+    SET_FORMALS(result, FORMALS(what));
+    SET_BODY(result, Serializer::body(packed));
+    SET_CLOENV(result, CLOENV(what));
+    Rf_copyMostAttrib(what, result);
+    Rf_setAttrib(result, symbol::rirPacked, packed);
+    return result;
+}
+
+REXPORT SEXP rir_image_write(SEXP file, SEXP packed) {
+    if (TYPEOF(file) != STRSXP || XLENGTH(file) != 1 || TYPEOF(packed) != VECSXP)
+        Rf_error("Invalid arguments");
+    Image::write(CHAR(STRING_ELT(file, 0)), packed);
+    return R_NilValue;
+}
+
+REXPORT SEXP rir_image_load(SEXP file) {
+    if (TYPEOF(file) != STRSXP || XLENGTH(file) != 1)
+        Rf_error("Invalid arguments");
+    int entries = Image::load(CHAR(STRING_ELT(file, 0)));
+    if (entries == -1)
+        Rf_error("Cannot load image %s", CHAR(STRING_ELT(file, 0)));
+    return Rf_ScalarInteger(entries);
+}
+
 extern SEXP testFunction;
 
 REXPORT SEXP rir_run_tests(SEXP fun) {
@@ -131,6 +197,15 @@ REXPORT SEXP rir_run_tests(SEXP fun) {
 
 bool startup() {
     initializeRuntime(rir_compile, Optimizer::reoptimizeFunction);
+    // RIR_BASELINE=1 turns it on, unset, empty, 0 or false do not
+    const char* baseline = getenv("RIR_BASELINE");
+    Compiler::baseline = baseline && *baseline &&
+                         strcmp(baseline, "0") != 0 &&
+                         strcasecmp(baseline, "false") != 0;
+    // precompiled closures are picked up lazily by rir_compile
+    const char* image = getenv("RIR_IMAGE");
+    if (image && Image::load(image) == -1)
+        Rf_warning("cannot load rir image %s", image);
     return true;
 }
 
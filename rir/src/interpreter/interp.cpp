@@ -242,6 +242,17 @@ SEXP createArgsList(Code* c, SEXP call, size_t nargs, CallSite* cs,
     return result;
 }
 
+/** Whether the arguments of callee can be passed as values, since its
+ * promises do not outlive the call.
+ */
+INLINE bool argsStayLocal(SEXP callee) {
+    SEXP body = BODY(callee);
+    if (TYPEOF(body) != EXTERNALSXP)
+        return false;
+    Function* fun = DispatchTable::unpack(body)->first();
+    return fun->argsLocal && !fun->envLeaked;
+}
+
 static SEXP closureArgumentAdaptor(SEXP call, SEXP op, SEXP arglist, SEXP rho,
                                    SEXP suppliedvars) {
     if (FORMALS(op) == R_NilValue && arglist == R_NilValue)
@@ -368,7 +379,8 @@ static SEXP rirCallClosure(SEXP call, SEXP env, SEXP callee, SEXP actuals,
             Function* oldFun = fun;
             cp_pool_add(ctx, oldFun->container());
 
-            SEXP opt = globalContext()->optimizer(fun->container());
+            SEXP opt = globalContext()->optimizer(fun->container(),
+                                                 CLOENV(callee));
 
             if (opt != nullptr) {
                 fun = Function::unpack(opt);
@@ -381,6 +393,7 @@ static SEXP rirCallClosure(SEXP call, SEXP env, SEXP callee, SEXP actuals,
                 fun->invocationCount = oldFun->invocationCount;
                 fun->envLeaked = oldFun->envLeaked;
                 fun->envChanged = oldFun->envChanged;
+                fun->argsLocal = oldFun->argsLocal;
 
                 UNPROTECT(1);  // funStore
             }
@@ -397,23 +410,32 @@ static SEXP rirCallClosure(SEXP call, SEXP env, SEXP callee, SEXP actuals,
 
     ostack_push(ctx, newEnv);
 
-    RCNTXT cntxt;
-    if (R_GlobalContext->callflag == CTXT_GENERIC)
-        Rf_begincontext(&cntxt, CTXT_RETURN, call, newEnv,
-                        R_GlobalContext->sysparent, actuals, callee);
-    else
-        Rf_begincontext(&cntxt, CTXT_RETURN, call, newEnv, env, actuals,
-                        callee);
-
-    // Exec the closure
-    closureDebug(call, callee, env, newEnv, &cntxt);
     Code* code = fun->body();
+    SEXP result;
+
+    // The optimizer proved that nothing in this version (nor in the version
+    // we could deopt to) can return non-locally or look at the context, thus
+    // we can skip begincontext and the setjmp.
+    if (fun->contextFree && R_GlobalContext->callflag != CTXT_GENERIC) {
+        result = evalRirCode(code, ctx, newEnv, nargs);
+    } else {
+        RCNTXT cntxt;
+        if (R_GlobalContext->callflag == CTXT_GENERIC)
+            Rf_begincontext(&cntxt, CTXT_RETURN, call, newEnv,
+                            R_GlobalContext->sysparent, actuals, callee);
+        else
+            Rf_begincontext(&cntxt, CTXT_RETURN, call, newEnv, env, actuals,
+                            callee);
+
+        // Exec the closure
+        closureDebug(call, callee, env, newEnv, &cntxt);
 
-    SEXP result = rirCallTrampoline(&cntxt, code, newEnv, nargs, ctx);
+        result = rirCallTrampoline(&cntxt, code, newEnv, nargs, ctx);
 
-    endClosureDebug(callee, call, env);
+        endClosureDebug(callee, call, env);
 
-    endClosureContext(&cntxt, result);
+        endClosureContext(&cntxt, result);
+    }
 
     if (!fun->envLeaked && FRAME_LEAKED(newEnv))
         fun->envLeaked = true;
@@ -529,9 +551,15 @@ SEXP doCall(Code* caller, SEXP callee, unsigned nargs, unsigned id, SEXP env,
         break;
     }
     case CLOSXP: {
+        // The optimizer only sets eagerArgs if evaluating the arguments has
+        // no effects, the callee must not let the promises escape either.
+        bool eager = cs->eagerArgs && argsStayLocal(callee);
         SEXP argslist =
-            createArgsList(caller, call, nargs, cs, env, ctx, false);
+            createArgsList(caller, call, nargs, cs, env, ctx, eager);
         PROTECT(argslist);
+        if (eager)
+            for (SEXP a = argslist; a != R_NilValue; a = CDR(a))
+                SET_NAMED(CAR(a), 2);
 
         // if body is EXTERNALSXP, it is rir serialized code, execute it
         // directly
@@ -1079,6 +1107,50 @@ enum op { PLUSOP, MINUSOP, TIMESOP, DIVOP, POWOP, MODOP, IDIVOP };
         ostack_set(ctx, 0, res);                                               \
     } while (false)
 
+// The operands of the typed arithmetic instructions are known to be simple
+// scalars of the right type, there is no fallback.
+#define DO_REAL_BINOP(op)                                                      \
+    do {                                                                       \
+        SEXP lhs = ostack_at(ctx, 1);                                          \
+        SEXP rhs = ostack_at(ctx, 0);                                          \
+        SLOWASSERT(IS_SIMPLE_SCALAR(lhs, REALSXP) &&                           \
+                   IS_SIMPLE_SCALAR(rhs, REALSXP));                            \
+        double real_res = (*REAL(lhs) == NA_REAL || *REAL(rhs) == NA_REAL)     \
+                              ? NA_REAL                                        \
+                              : *REAL(lhs) op * REAL(rhs);                     \
+        STORE_BINOP(REALSXP, 0, real_res);                                     \
+        ostack_pop(ctx);                                                       \
+        ostack_set(ctx, 0, res);                                               \
+    } while (false)
+
+#define DO_INT_BINOP(fun)                                                      \
+    do {                                                                       \
+        SEXP lhs = ostack_at(ctx, 1);                                          \
+        SEXP rhs = ostack_at(ctx, 0);                                          \
+        SLOWASSERT(IS_SIMPLE_SCALAR(lhs, INTSXP) &&                            \
+                   IS_SIMPLE_SCALAR(rhs, INTSXP));                             \
+        Rboolean naflag = FALSE;                                               \
+        int int_res = fun(*INTEGER(lhs), *INTEGER(rhs), &naflag);              \
+        CHECK_INTEGER_OVERFLOW(R_NilValue, naflag);                            \
+        STORE_BINOP(INTSXP, int_res, 0);                                       \
+        ostack_pop(ctx);                                                       \
+        ostack_set(ctx, 0, res);                                               \
+    } while (false)
+
+// The optimizer proved that neither operand is NA and that the result fits
+#define DO_INT_BINOP_UNCHECKED(op)                                             \
+    do {                                                                       \
+        SEXP lhs = ostack_at(ctx, 1);                                          \
+        SEXP rhs = ostack_at(ctx, 0);                                          \
+        SLOWASSERT(IS_SIMPLE_SCALAR(lhs, INTSXP) &&                            \
+                   IS_SIMPLE_SCALAR(rhs, INTSXP));                             \
+        int int_res = *INTEGER(lhs) op * INTEGER(rhs);                         \
+        SLOWASSERT(int_res != NA_INTEGER);                                     \
+        STORE_BINOP(INTSXP, int_res, 0);                                       \
+        ostack_pop(ctx);                                                       \
+        ostack_set(ctx, 0, res);                                               \
+    } while (false)
+
 static double myfloor(double x1, double x2) {
     double q = x1 / x2, tmp;
 
@@ -1215,6 +1287,96 @@ static R_INLINE int R_integer_uminus(int x, Rboolean* pnaflag) {
         BINOP_FALLBACK(#op);                                                   \
     } while (false)
 
+/** Converts the value of a condition to a boolean the way if and while do.
+ * Signals an error if the value is NA or has length zero, pc is the
+ * instruction whose source is reported.
+ */
+static bool asCondition(SEXP val, Code* c, Opcode* pc, Context* ctx) {
+    int cond = NA_LOGICAL;
+    if (XLENGTH(val) > 1)
+        warningcall(getSrcAt(c, pc, ctx),
+                    ("the condition has length > 1 and only the first "
+                     "element will be used"));
+
+    if (XLENGTH(val) > 0) {
+        switch (TYPEOF(val)) {
+        case LGLSXP:
+            cond = LOGICAL(val)[0];
+            break;
+        case INTSXP:
+            cond = INTEGER(val)[0]; // relies on NA_INTEGER == NA_LOGICAL
+            break;
+        default:
+            cond = asLogical(val);
+        }
+    }
+
+    if (cond == NA_LOGICAL) {
+        const char* msg =
+            XLENGTH(val) ? (isLogical(val)
+                                ? ("missing value where TRUE/FALSE needed")
+                                : ("argument is not interpretable as logical"))
+                         : ("argument is of length zero");
+        errorcall(getSrcAt(c, pc, ctx), msg);
+    }
+
+    return cond;
+}
+
+// Fused relop + asbool + brfalse. DO_RELOP's scalar paths only ever produce
+// R_TrueValue, R_FalseValue or R_LogicalNAValue, so the common case branches
+// without touching the heap. Anything else (including NA) goes through
+// asCondition for the proper error.
+#define DO_RELOP_BRFALSE(op)                                                   \
+    do {                                                                       \
+        JumpOffset offset = readJumpOffset();                                  \
+        SEXP lhs = ostack_at(ctx, 1);                                          \
+        SEXP rhs = ostack_at(ctx, 0);                                          \
+        DO_RELOP(op);                                                          \
+        ostack_popn(ctx, 2);                                                   \
+        if (res != R_TrueValue && res != R_FalseValue) {                       \
+            ostack_push(ctx, res);                                             \
+            res = asCondition(res, c, pc - 1, ctx) ? R_TrueValue               \
+                                                   : R_FalseValue;             \
+            ostack_pop(ctx);                                                   \
+        }                                                                      \
+        advanceJump();                                                         \
+        if (res == R_FalseValue) {                                             \
+            pc = pc + offset;                                                  \
+            if (offset < 0)                                                    \
+                incPerfCount(c);                                               \
+        }                                                                      \
+        PC_BOUNDSCHECK(pc, c);                                                 \
+    } while (false)
+
+// DO_RELOP_BRFALSE for operands known to be simple scalars of the same type.
+// NA still goes through asCondition for the error.
+#define DO_TYPED_RELOP_BRFALSE(op, ACCESSOR, ISNA)                             \
+    do {                                                                       \
+        JumpOffset offset = readJumpOffset();                                  \
+        SEXP lhs = ostack_at(ctx, 1);                                          \
+        SEXP rhs = ostack_at(ctx, 0);                                          \
+        SLOWASSERT(TYPEOF(lhs) == TYPEOF(rhs) && XLENGTH(lhs) == 1 &&          \
+                   XLENGTH(rhs) == 1);                                         \
+        auto l = *ACCESSOR(lhs);                                               \
+        auto r = *ACCESSOR(rhs);                                               \
+        ostack_popn(ctx, 2);                                                   \
+        bool cond;                                                             \
+        if (ISNA(l) || ISNA(r))                                                \
+            cond = asCondition(R_LogicalNAValue, c, pc - 1, ctx);              \
+        else                                                                   \
+            cond = l op r;                                                     \
+        advanceJump();                                                         \
+        if (!cond) {                                                           \
+            pc = pc + offset;                                                  \
+            if (offset < 0)                                                    \
+                incPerfCount(c);                                               \
+        }                                                                      \
+        PC_BOUNDSCHECK(pc, c);                                                 \
+    } while (false)
+
+#define INT_ISNA(x) ((x) == NA_INTEGER)
+
 static SEXP seq_int(int n1, int n2) {
     int n = n1 <= n2 ? n2 - n1 + 1 : n1 - n2 + 1;
     SEXP ans = Rf_allocVector(INTSXP, n);
@@ -1294,6 +1456,157 @@ INLINE SEXP cachedGetBindingCell(SEXP env, Immediate idx, Context* ctx,
     return NULL;
 }
 
+#define ACTIVE_BINDING_MASK (1 << 15)
+#define BINDING_LOCK_MASK (1 << 14)
+#define IS_ACTIVE_BINDING(b) ((b)->sxpinfo.gp & ACTIVE_BINDING_MASK)
+#define BINDING_IS_LOCKED(b) ((b)->sxpinfo.gp & BINDING_LOCK_MASK)
+
+/** Lookup cache for variables defined outside of the local frames.
+ *
+ * Entries are keyed by the symbol and the first locked environment on the
+ * lookup path, and hold the binding cell found by walking from there. Since
+ * a locked environment can never get new bindings (nor be unlocked again), an
+ * entry stays valid as long as every frame from the key up to the defining
+ * one was locked when the entry was filled. Assignments to the cached binding
+ * go to the same cell, so we always read the current value. This covers
+ * package namespaces, their imports and the base namespace. R_GlobalEnv is
+ * never locked, but GNU R already has its own global cache for it.
+ *
+ * Keys are kept alive in a preserved list, such that an address can never be
+ * reused by a different environment while it is in the cache.
+ */
+#define GLOBAL_CACHE_SIZE 512
+typedef struct {
+    SEXP sym;
+    SEXP env;
+    SEXP cell; // the symbol itself for bindings in base
+} GlobalCacheEntry;
+
+static GlobalCacheEntry globalCache[GLOBAL_CACHE_SIZE];
+static SEXP globalCacheRoots = nullptr;
+
+INLINE unsigned globalCacheIdx(SEXP sym, SEXP env) {
+    return ((((uintptr_t)sym) ^ ((uintptr_t)env)) >> 4) % GLOBAL_CACHE_SIZE;
+}
+
+INLINE bool isBaseEnv(SEXP env) {
+    return env == R_BaseEnv || env == R_BaseNamespace;
+}
+
+static void globalCachePut(SEXP sym, SEXP env, SEXP cell) {
+    if (!globalCacheRoots) {
+        globalCacheRoots = Rf_allocVector(VECSXP, 2 * GLOBAL_CACHE_SIZE);
+        R_PreserveObject(globalCacheRoots);
+    }
+    unsigned i = globalCacheIdx(sym, env);
+    globalCache[i].sym = sym;
+    globalCache[i].env = env;
+    globalCache[i].cell = cell;
+    SET_VECTOR_ELT(globalCacheRoots, 2 * i, env);
+    SET_VECTOR_ELT(globalCacheRoots, 2 * i + 1, cell);
+}
+
+/** Looks up sym starting at the locked environment rho, filling the global
+ * cache if the binding is found before the first unlocked frame.
+ */
+static SEXP lockedFindVar(SEXP sym, SEXP rho) {
+    unsigned i = globalCacheIdx(sym, rho);
+    if (globalCache[i].sym == sym && globalCache[i].env == rho) {
+        SEXP cell = globalCache[i].cell;
+        return cell == sym ? SYMVALUE(sym) : CAR(cell);
+    }
+
+    SEXP start = rho;
+    while (rho != R_EmptyEnv) {
+        if (isBaseEnv(rho)) {
+            if (IS_ACTIVE_BINDING(sym))
+                return findVar(sym, rho);
+            SEXP val = SYMVALUE(sym);
+            if (val != R_UnboundValue) {
+                globalCachePut(sym, start, sym);
+                return val;
+            }
+        } else {
+            if (rho == R_GlobalEnv || !R_EnvironmentIsLocked(rho))
+                return findVar(sym, rho);
+            R_varloc_t loc = R_findVarLocInFrame(rho, sym);
+            if (!R_VARLOC_IS_NULL(loc)) {
+                if (IS_ACTIVE_BINDING(loc.cell))
+                    return findVar(sym, rho);
+                globalCachePut(sym, start, loc.cell);
+                return CAR(loc.cell);
+            }
+        }
+        rho = ENCLOS(rho);
+    }
+    return R_UnboundValue;
+}
+
+/** Same as findVar, but uses the global cache once the lookup reaches a
+ * locked environment.
+ */
+static SEXP cachedFindVar(SEXP sym, SEXP rho) {
+    while (rho != R_EmptyEnv) {
+        if (rho == R_GlobalEnv)
+            return findVar(sym, rho);
+        if (isBaseEnv(rho) || R_EnvironmentIsLocked(rho))
+            return lockedFindVar(sym, rho);
+        R_varloc_t loc = R_findVarLocInFrame(rho, sym);
+        if (!R_VARLOC_IS_NULL(loc)) {
+            // let findVar deal with active bindings
+            if (IS_ACTIVE_BINDING(loc.cell))
+                return findVar(sym, rho);
+            return CAR(loc.cell);
+        }
+        rho = ENCLOS(rho);
+    }
+    return R_UnboundValue;
+}
+
+/** Per instruction cache for the binding cells used by ldvar2_ and stvar2_.
+ *
+ * We only cache bindings found directly in the enclosing frame (ie. the
+ * closure environment of accumulators and memo tables) of frames which are
+ * not marked as changed. Removing a binding marks the frame as changed, so
+ * the cell stays valid for as long as the flag is clear. Frames are kept
+ * alive while they are in the cache.
+ */
+#define SUPER_ASSIGN_CACHE_SIZE 256
+typedef struct {
+    Opcode* pc;
+    SEXP sym;
+    SEXP env;
+    SEXP cell;
+} SuperAssignCacheEntry;
+
+static SuperAssignCacheEntry superAssignCache[SUPER_ASSIGN_CACHE_SIZE];
+static SEXP superAssignCacheRoots = nullptr;
+
+static SEXP superAssignCell(Opcode* pc, SEXP sym, SEXP rho) {
+    if (FRAME_CHANGED(rho) || isBaseEnv(rho) || rho == R_GlobalEnv)
+        return NULL;
+
+    SuperAssignCacheEntry& e =
+        superAssignCache[(((uintptr_t)pc) >> 2) % SUPER_ASSIGN_CACHE_SIZE];
+    if (e.pc == pc && e.sym == sym && e.env == rho)
+        return e.cell;
+
+    R_varloc_t loc = R_findVarLocInFrame(rho, sym);
+    if (R_VARLOC_IS_NULL(loc) || IS_ACTIVE_BINDING(loc.cell))
+        return NULL;
+
+    if (!superAssignCacheRoots) {
+        superAssignCacheRoots = Rf_allocVector(VECSXP, SUPER_ASSIGN_CACHE_SIZE);
+        R_PreserveObject(superAssignCacheRoots);
+    }
+    e.pc = pc;
+    e.sym = sym;
+    e.env = rho;
+    e.cell = loc.cell;
+    SET_VECTOR_ELT(superAssignCacheRoots, &e - superAssignCache, rho);
+    return loc.cell;
+}
+
 static SEXP cachedGetVar(SEXP env, Immediate idx, Context* ctx,
                          BindingCache* bindingCache) {
     SEXP loc = cachedGetBindingCell(env, idx, ctx, bindingCache);
@@ -1304,20 +1617,23 @@ static SEXP cachedGetVar(SEXP env, Immediate idx, Context* ctx,
     }
     SEXP sym = cp_pool_at(ctx, idx);
     SLOWASSERT(TYPEOF(sym) == SYMSXP);
-    return findVar(sym, env);
+    // the local frame was already searched above
+    if (isBaseEnv(env))
+        return findVar(sym, env);
+    return cachedFindVar(sym, ENCLOS(env));
 }
 
-#define ACTIVE_BINDING_MASK (1 << 15)
-#define BINDING_LOCK_MASK (1 << 14)
-#define IS_ACTIVE_BINDING(b) ((b)->sxpinfo.gp & ACTIVE_BINDING_MASK)
-#define BINDING_IS_LOCKED(b) ((b)->sxpinfo.gp & BINDING_LOCK_MASK)
 static void cachedSetVar(SEXP val, SEXP env, Immediate idx, Context* ctx,
                          BindingCache* bindingCache) {
     SEXP loc = cachedGetBindingCell(env, idx, ctx, bindingCache);
     if (loc && !BINDING_IS_LOCKED(loc) && !IS_ACTIVE_BINDING(loc)) {
         SEXP cur = CAR(loc);
-        if (cur == val)
+        if (cur == val) {
+            // updated in place after reuse_
+            if (NAMED(val) == 0)
+                SET_NAMED(val, 1);
             return;
+        }
         INCREMENT_NAMED(val);
         SETCAR(loc, val);
         if (MISSING(loc))
@@ -1426,8 +1742,11 @@ SEXP evalRirCode(Code* c, Context* ctx, SEXP env, unsigned numArgs) {
 
         INSTRUCTION(ldvar2_) {
             SEXP sym = readConst(ctx, readImmediate());
+            SEXP loc = superAssignCell(pc - 1, sym, ENCLOS(env));
             advanceImmediate();
-            res = findVar(sym, ENCLOS(env));
+            res = loc ? CAR(loc) : R_UnboundValue;
+            if (res == R_UnboundValue)
+                res = cachedFindVar(sym, ENCLOS(env));
             R_Visible = TRUE;
 
             if (res == R_UnboundValue) {
@@ -1578,6 +1897,28 @@ SEXP evalRirCode(Code* c, Context* ctx, SEXP env, unsigned numArgs) {
             NEXT();
         }
 
+        INSTRUCTION(lazy_) {
+            Opcode* insn = pc - 1;
+            SEXP ast = readConst(ctx, readImmediate());
+            SEXP fun = ctx->compiler(ast, NULL);
+            PROTECT(fun);
+            Immediate idx = cp_pool_add(ctx, fun);
+            UNPROTECT(1);
+            // later evaluations of this promise skip the compiler
+            *insn = Opcode::run_lazy_;
+            *(Immediate*)(insn + 1) = idx;
+            pc = insn;
+            NEXT();
+        }
+
+        INSTRUCTION(run_lazy_) {
+            Function* fun = Function::unpack(readConst(ctx, readImmediate()));
+            advanceImmediate();
+            res = evalRirCode(fun->body(), ctx, env, 0);
+            ostack_push(ctx, res);
+            NEXT();
+        }
+
         INSTRUCTION(close_) {
             SEXP srcref = ostack_at(ctx, 0);
             SEXP body = ostack_at(ctx, 1);
@@ -1738,11 +2079,30 @@ SEXP evalRirCode(Code* c, Context* ctx, SEXP env, unsigned numArgs) {
             NEXT();
         }
 
+        INSTRUCTION(clear_) {
+            Immediate id = readImmediate();
+            advanceImmediate();
+            SEXP loc = cachedGetBindingCell(env, id, ctx, bindingCache);
+            if (loc && !BINDING_IS_LOCKED(loc) && !IS_ACTIVE_BINDING(loc))
+                SETCAR(loc, R_NilValue);
+            NEXT();
+        }
+
         INSTRUCTION(stvar2_) {
             SEXP sym = readConst(ctx, readImmediate());
+            SEXP loc = superAssignCell(pc - 1, sym, ENCLOS(env));
             advanceImmediate();
             SLOWASSERT(TYPEOF(sym) == SYMSXP);
             SEXP val = ostack_pop(ctx);
+            if (loc && !BINDING_IS_LOCKED(loc)) {
+                if (CAR(loc) != val) {
+                    INCREMENT_NAMED(val);
+                    SETCAR(loc, val);
+                    if (MISSING(loc))
+                        SET_MISSING(loc, 0);
+                }
+                NEXT();
+            }
             INCREMENT_NAMED(val);
             setVar(sym, val, ENCLOS(env));
             NEXT();
@@ -1826,6 +2186,56 @@ SEXP evalRirCode(Code* c, Context* ctx, SEXP env, unsigned numArgs) {
             NEXT();
         }
 
+        INSTRUCTION(add_int_) {
+            DO_INT_BINOP(R_integer_plus);
+            NEXT();
+        }
+
+        INSTRUCTION(sub_int_) {
+            DO_INT_BINOP(R_integer_minus);
+            NEXT();
+        }
+
+        INSTRUCTION(mul_int_) {
+            DO_INT_BINOP(R_integer_times);
+            NEXT();
+        }
+
+        INSTRUCTION(add_int_unchecked_) {
+            DO_INT_BINOP_UNCHECKED(+);
+            NEXT();
+        }
+
+        INSTRUCTION(sub_int_unchecked_) {
+            DO_INT_BINOP_UNCHECKED(-);
+            NEXT();
+        }
+
+        INSTRUCTION(mul_int_unchecked_) {
+            DO_INT_BINOP_UNCHECKED(*);
+            NEXT();
+        }
+
+        INSTRUCTION(add_real_) {
+            DO_REAL_BINOP(+);
+            NEXT();
+        }
+
+        INSTRUCTION(sub_real_) {
+            DO_REAL_BINOP(-);
+            NEXT();
+        }
+
+        INSTRUCTION(mul_real_) {
+            DO_REAL_BINOP(*);
+            NEXT();
+        }
+
+        INSTRUCTION(div_real_) {
+            DO_REAL_BINOP(/);
+            NEXT();
+        }
+
         INSTRUCTION(idiv_) {
             SEXP lhs = ostack_at(ctx, 1);
             SEXP rhs = ostack_at(ctx, 0);
@@ -2017,36 +2427,7 @@ SEXP evalRirCode(Code* c, Context* ctx, SEXP env, unsigned numArgs) {
 
         INSTRUCTION(asbool_) {
             SEXP val = ostack_top(ctx);
-            int cond = NA_LOGICAL;
-            if (XLENGTH(val) > 1)
-                warningcall(getSrcAt(c, pc - 1, ctx),
-                            ("the condition has length > 1 and only the first "
-                             "element will be used"));
-
-            if (XLENGTH(val) > 0) {
-                switch (TYPEOF(val)) {
-                case LGLSXP:
-                    cond = LOGICAL(val)[0];
-                    break;
-                case INTSXP:
-                    cond =
-                        INTEGER(val)[0]; // relies on NA_INTEGER == NA_LOGICAL
-                    break;
-                default:
-                    cond = asLogical(val);
-                }
-            }
-
-            if (cond == NA_LOGICAL) {
-                const char* msg =
-                    XLENGTH(val)
-                        ? (isLogical(val)
-                               ? ("missing value where TRUE/FALSE needed")
-                               : ("argument is not interpretable as logical"))
-                        : ("argument is of length zero");
-                errorcall(getSrcAt(c, pc - 1, ctx), msg);
-            }
-
+            bool cond = asCondition(val, c, pc - 1, ctx);
             ostack_pop(ctx);
             ostack_push(ctx, cond ? R_TrueValue : R_FalseValue);
             NEXT();
@@ -2160,6 +2541,96 @@ SEXP evalRirCode(Code* c, Context* ctx, SEXP env, unsigned numArgs) {
             NEXT();
         }
 
+        INSTRUCTION(brfalse_lt_) {
+            DO_RELOP_BRFALSE(< );
+            NEXT();
+        }
+
+        INSTRUCTION(brfalse_gt_) {
+            DO_RELOP_BRFALSE(> );
+            NEXT();
+        }
+
+        INSTRUCTION(brfalse_le_) {
+            DO_RELOP_BRFALSE(<= );
+            NEXT();
+        }
+
+        INSTRUCTION(brfalse_ge_) {
+            DO_RELOP_BRFALSE(>= );
+            NEXT();
+        }
+
+        INSTRUCTION(brfalse_eq_) {
+            DO_RELOP_BRFALSE(== );
+            NEXT();
+        }
+
+        INSTRUCTION(brfalse_ne_) {
+            DO_RELOP_BRFALSE(!= );
+            NEXT();
+        }
+
+        INSTRUCTION(brfalse_lt_int_) {
+            DO_TYPED_RELOP_BRFALSE(<, INTEGER, INT_ISNA);
+            NEXT();
+        }
+
+        INSTRUCTION(brfalse_gt_int_) {
+            DO_TYPED_RELOP_BRFALSE(>, INTEGER, INT_ISNA);
+            NEXT();
+        }
+
+        INSTRUCTION(brfalse_le_int_) {
+            DO_TYPED_RELOP_BRFALSE(<=, INTEGER, INT_ISNA);
+            NEXT();
+        }
+
+        INSTRUCTION(brfalse_ge_int_) {
+            DO_TYPED_RELOP_BRFALSE(>=, INTEGER, INT_ISNA);
+            NEXT();
+        }
+
+        INSTRUCTION(brfalse_eq_int_) {
+            DO_TYPED_RELOP_BRFALSE(==, INTEGER, INT_ISNA);
+            NEXT();
+        }
+
+        INSTRUCTION(brfalse_ne_int_) {
+            DO_TYPED_RELOP_BRFALSE(!=, INTEGER, INT_ISNA);
+            NEXT();
+        }
+
+        INSTRUCTION(brfalse_lt_real_) {
+            DO_TYPED_RELOP_BRFALSE(<, REAL, ISNAN);
+            NEXT();
+        }
+
+        INSTRUCTION(brfalse_gt_real_) {
+            DO_TYPED_RELOP_BRFALSE(>, REAL, ISNAN);
+            NEXT();
+        }
+
+        INSTRUCTION(brfalse_le_real_) {
+            DO_TYPED_RELOP_BRFALSE(<=, REAL, ISNAN);
+            NEXT();
+        }
+
+        INSTRUCTION(brfalse_ge_real_) {
+            DO_TYPED_RELOP_BRFALSE(>=, REAL, ISNAN);
+            NEXT();
+        }
+
+        INSTRUCTION(brfalse_eq_real_) {
+            DO_TYPED_RELOP_BRFALSE(==, REAL, ISNAN);
+            NEXT();
+        }
+
+        INSTRUCTION(brfalse_ne_real_) {
+            DO_TYPED_RELOP_BRFALSE(!=, REAL, ISNAN);
+            NEXT();
+        }
+
         INSTRUCTION(br_) {
             JumpOffset offset = readJumpOffset();
             advanceJump();
@@ -2278,6 +2749,8 @@ SEXP evalRirCode(Code* c, Context* ctx, SEXP env, unsigned numArgs) {
                                 INTEGER(orig)[idx_] = *INTEGER(val);
                                 break;
                             case VECSXP:
+                                // the element is another reference to val
+                                INCREMENT_NAMED(val);
                                 SET_VECTOR_ELT(orig, idx_, val);
                                 break;
                             }
@@ -2393,6 +2866,48 @@ SEXP evalRirCode(Code* c, Context* ctx, SEXP env, unsigned numArgs) {
         }
         }
 
+        INSTRUCTION(extract1_unchecked_) {
+            SEXP idx = ostack_at(ctx, 0);
+            SEXP val = ostack_at(ctx, 1);
+            // The optimizer proved idx to be a whole number within the bounds
+            SLOWASSERT(IS_SIMPLE_SCALAR(idx, INTSXP) ||
+                       IS_SIMPLE_SCALAR(idx, REALSXP));
+            int i = TYPEOF(idx) == INTSXP ? *INTEGER(idx) - 1
+                                          : (int)*REAL(idx) - 1;
+            SLOWASSERT(i >= 0 && i < XLENGTH(val));
+
+            switch (TYPEOF(val)) {
+            case REALSXP:
+                res = allocVector(REALSXP, 1);
+                *REAL(res) = REAL(val)[i];
+                break;
+            case INTSXP:
+                res = allocVector(INTSXP, 1);
+                *INTEGER(res) = INTEGER(val)[i];
+                break;
+            case LGLSXP:
+                res = allocVector(LGLSXP, 1);
+                *LOGICAL(res) = LOGICAL(val)[i];
+                break;
+            case VECSXP:
+                res = VECTOR_ELT(val, i);
+                break;
+            default: {
+                SEXP args = CONS_NR(idx, R_NilValue);
+                args = CONS_NR(val, args);
+                ostack_push(ctx, args);
+                res = do_subset2_dflt(R_NilValue, R_Subset2Sym, args, env);
+                ostack_pop(ctx);
+                break;
+            }
+            }
+
+            R_Visible = TRUE;
+            ostack_popn(ctx, 2);
+            ostack_push(ctx, res);
+            NEXT();
+        }
+
         INSTRUCTION(extract2_) {
             SEXP idx2 = ostack_at(ctx, 0);
             SEXP idx = ostack_at(ctx, 1);
@@ -2589,6 +3104,33 @@ SEXP evalRirCode(Code* c, Context* ctx, SEXP env, unsigned numArgs) {
             NEXT();
         }
 
+        INSTRUCTION(for_step_) {
+            JumpOffset offset = readJumpOffset();
+            advanceJump();
+            SEXP idx = ostack_at(ctx, 0);
+            assert(TYPEOF(idx) == INTSXP);
+            int i = INTEGER(idx)[0] + 1;
+            if (MAYBE_SHARED(idx)) {
+                idx = Rf_allocVector(INTSXP, 1);
+                ostack_set(ctx, 0, idx);
+            }
+            INTEGER(idx)[0] = i;
+
+            SEXP val = ostack_at(ctx, 1);
+            R_xlen_t len;
+            if (isVector(val)) {
+                len = LENGTH(val);
+            } else if (isList(val) || isNull(val)) {
+                len = Rf_length(val);
+            } else {
+                errorcall(R_NilValue, "invalid for() loop sequence");
+            }
+            if (i <= 0 || i > len)
+                pc = pc + offset;
+            PC_BOUNDSCHECK(pc, c);
+            NEXT();
+        }
+
         INSTRUCTION(visible_) {
             R_Visible = TRUE;
             NEXT();
@@ -2617,9 +3159,20 @@ SEXP evalRirCode(Code* c, Context* ctx, SEXP env, unsigned numArgs) {
             NEXT();
         }
 
+        INSTRUCTION(reuse_) {
+            // the binding is the only reference, STORE_BINOP may reuse it
+            SEXP val = ostack_at(ctx, 1);
+            if (NAMED(val) == 1)
+                SET_NAMED(val, 0);
+            NEXT();
+        }
+
         INSTRUCTION(beginloop_) {
-            // Allocate a RCNTXT on the stack
-            SEXP val = Rf_allocVector(RAWSXP, sizeof(RCNTXT) + sizeof(pc));
+            // Get a RCNTXT buffer, reusing the ones released by endcontext_,
+            // and keep it on the stack
+            SEXP val = loopctx_pool_take(ctx);
+            if (!val)
+                val = Rf_allocVector(RAWSXP, sizeof(RCNTXT) + sizeof(pc));
             ostack_push(ctx, val);
 
             RCNTXT* cntxt = (RCNTXT*)RAW(val);
@@ -2664,6 +3217,7 @@ SEXP evalRirCode(Code* c, Context* ctx, SEXP env, unsigned numArgs) {
             RCNTXT* cntxt = (RCNTXT*)RAW(val);
             Rf_endcontext(cntxt);
             ostack_pop(ctx); // Context
+            loopctx_pool_release(ctx, val);
             NEXT();
         }
 
@@ -21,13 +21,15 @@ SEXP quoteSym;
 Context* context_create(CompilerCallback compiler,
                         OptimizerCallback optimizer) {
     Context* c = new Context;
-    c->list = Rf_allocVector(VECSXP, 2);
+    c->list = Rf_allocVector(VECSXP, 3);
     c->optimizer = optimizer;
     c->compiler = compiler;
     R_PreserveObject(c->list);
     initializeResizeableList(&c->cp, POOL_CAPACITY, c->list, CONTEXT_INDEX_CP);
     initializeResizeableList(&c->src, POOL_CAPACITY, c->list,
                              CONTEXT_INDEX_SRC);
+    initializeResizeableList(&c->loopctx, LOOPCTX_POOL_CAPACITY, c->list,
+                             CONTEXT_INDEX_LOOPCTX);
     // first item in source and constant pools is R_NilValue so that we can use
     // the index 0 for other purposes
     src_pool_add(c, R_NilValue);
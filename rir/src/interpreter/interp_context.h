@@ -16,7 +16,7 @@
   The idea is to call this if we want on demand compilation of closures.
  */
 typedef SEXP (*CompilerCallback)(SEXP, SEXP);
-typedef SEXP (*OptimizerCallback)(SEXP);
+typedef SEXP (*OptimizerCallback)(SEXP, SEXP);
 
 #ifdef __cplusplus
 extern "C" {
@@ -38,6 +38,10 @@ typedef struct {
 
 #define CONTEXT_INDEX_CP 0
 #define CONTEXT_INDEX_SRC 1
+#define CONTEXT_INDEX_LOOPCTX 2
+
+/** Number of loop context buffers kept around for reuse. */
+#define LOOPCTX_POOL_CAPACITY 64
 
 /** Interpreter's context.
 
@@ -49,6 +53,7 @@ typedef struct {
     SEXP list;
     ResizeableList cp;
     ResizeableList src;
+    ResizeableList loopctx;
     CompilerCallback compiler;
     OptimizerCallback optimizer;
 } Context;
@@ -179,6 +184,26 @@ INLINE size_t src_pool_add(Context* c, SEXP v) {
 #define cp_pool_at(c, index) (VECTOR_ELT((c)->cp.list, (index)))
 #define src_pool_at(c, value) (VECTOR_ELT((c)->src.list, (value)))
 
+/** Returns a previously released loop context buffer, or NULL if there is
+ * none. Buffers that were skipped by a longjmp are never released and are
+ * left to the gc.
+ */
+INLINE SEXP loopctx_pool_take(Context* c) {
+    size_t i = rl_length(&c->loopctx);
+    if (i == 0)
+        return NULL;
+    rl_setLength(&c->loopctx, i - 1);
+    return VECTOR_ELT(c->loopctx.list, i - 1);
+}
+
+INLINE void loopctx_pool_release(Context* c, SEXP v) {
+    size_t i = rl_length(&c->loopctx);
+    if (i == c->loopctx.capacity)
+        return;
+    rl_setLength(&c->loopctx, i + 1);
+    SET_VECTOR_ELT(c->loopctx.list, i, v);
+}
+
 #ifdef __cplusplus
 }
 #endif
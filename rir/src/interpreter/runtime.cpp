@@ -48,6 +48,7 @@ void printFunction(Function* f) {
     Rprintf("  Code objects:    %u\n", f->codeLength);
     Rprintf("  Fun code offset: %x (hex)\n", f->foffset);
     Rprintf("  Invoked:         %u\n", f->invocationCount);
+    Rprintf("  Context free:    %s\n", f->contextFree ? "yes" : "no");
 
     if (f->magic != FUNCTION_MAGIC)
         Rf_error("Wrong magic number -- not rir bytecode");
@@ -27,8 +27,11 @@ bool BC::operator==(const BC& other) const {
     case Opcode::ldlval_:
     case Opcode::stvar_:
     case Opcode::stvar2_:
+    case Opcode::clear_:
     case Opcode::missing_:
     case Opcode::subassign2_:
+    case Opcode::lazy_:
+    case Opcode::run_lazy_:
         return immediate.pool == other.immediate.pool;
 
     case Opcode::dispatch_:
@@ -54,8 +57,27 @@ bool BC::operator==(const BC& other) const {
     case Opcode::br_:
     case Opcode::brtrue_:
     case Opcode::beginloop_:
+    case Opcode::for_step_:
     case Opcode::brobj_:
     case Opcode::brfalse_:
+    case Opcode::brfalse_lt_:
+    case Opcode::brfalse_gt_:
+    case Opcode::brfalse_le_:
+    case Opcode::brfalse_ge_:
+    case Opcode::brfalse_eq_:
+    case Opcode::brfalse_ne_:
+    case Opcode::brfalse_lt_int_:
+    case Opcode::brfalse_gt_int_:
+    case Opcode::brfalse_le_int_:
+    case Opcode::brfalse_ge_int_:
+    case Opcode::brfalse_eq_int_:
+    case Opcode::brfalse_ne_int_:
+    case Opcode::brfalse_lt_real_:
+    case Opcode::brfalse_gt_real_:
+    case Opcode::brfalse_le_real_:
+    case Opcode::brfalse_ge_real_:
+    case Opcode::brfalse_eq_real_:
+    case Opcode::brfalse_ne_real_:
     case Opcode::label:
         return immediate.offset == other.immediate.offset;
 
@@ -71,6 +93,7 @@ bool BC::operator==(const BC& other) const {
     case Opcode::extract2_:
     case Opcode::subset1_:
     case Opcode::extract1_:
+    case Opcode::extract1_unchecked_:
     case Opcode::ret_:
     case Opcode::length_:
     case Opcode::names_:
@@ -86,6 +109,7 @@ bool BC::operator==(const BC& other) const {
     case Opcode::swap_:
     case Opcode::int3_:
     case Opcode::make_unique_:
+    case Opcode::reuse_:
     case Opcode::set_shared_:
     case Opcode::aslogical_:
     case Opcode::lgl_and_:
@@ -98,6 +122,16 @@ bool BC::operator==(const BC& other) const {
     case Opcode::mod_:
     case Opcode::pow_:
     case Opcode::sub_:
+    case Opcode::add_real_:
+    case Opcode::sub_real_:
+    case Opcode::mul_real_:
+    case Opcode::div_real_:
+    case Opcode::add_int_:
+    case Opcode::sub_int_:
+    case Opcode::mul_int_:
+    case Opcode::add_int_unchecked_:
+    case Opcode::sub_int_unchecked_:
+    case Opcode::mul_int_unchecked_:
     case Opcode::uplus_:
     case Opcode::uminus_:
     case Opcode::not_:
@@ -138,8 +172,11 @@ void BC::write(CodeStream& cs) const {
     case Opcode::ldlval_:
     case Opcode::stvar_:
     case Opcode::stvar2_:
+    case Opcode::clear_:
     case Opcode::missing_:
     case Opcode::subassign2_:
+    case Opcode::lazy_:
+    case Opcode::run_lazy_:
         cs.insert(immediate.pool);
         return;
 
@@ -168,8 +205,27 @@ void BC::write(CodeStream& cs) const {
     case Opcode::br_:
     case Opcode::brtrue_:
     case Opcode::beginloop_:
+    case Opcode::for_step_:
     case Opcode::brobj_:
     case Opcode::brfalse_:
+    case Opcode::brfalse_lt_:
+    case Opcode::brfalse_gt_:
+    case Opcode::brfalse_le_:
+    case Opcode::brfalse_ge_:
+    case Opcode::brfalse_eq_:
+    case Opcode::brfalse_ne_:
+    case Opcode::brfalse_lt_int_:
+    case Opcode::brfalse_gt_int_:
+    case Opcode::brfalse_le_int_:
+    case Opcode::brfalse_ge_int_:
+    case Opcode::brfalse_eq_int_:
+    case Opcode::brfalse_ne_int_:
+    case Opcode::brfalse_lt_real_:
+    case Opcode::brfalse_gt_real_:
+    case Opcode::brfalse_le_real_:
+    case Opcode::brfalse_ge_real_:
+    case Opcode::brfalse_eq_real_:
+    case Opcode::brfalse_ne_real_:
         cs.patchpoint(immediate.offset);
         return;
 
@@ -186,6 +242,7 @@ void BC::write(CodeStream& cs) const {
     case Opcode::extract2_:
     case Opcode::subset1_:
     case Opcode::extract1_:
+    case Opcode::extract1_unchecked_:
     case Opcode::ret_:
     case Opcode::length_:
     case Opcode::names_:
@@ -201,6 +258,7 @@ void BC::write(CodeStream& cs) const {
     case Opcode::swap_:
     case Opcode::int3_:
     case Opcode::make_unique_:
+    case Opcode::reuse_:
     case Opcode::set_shared_:
     case Opcode::aslogical_:
     case Opcode::lgl_and_:
@@ -213,6 +271,16 @@ void BC::write(CodeStream& cs) const {
     case Opcode::mod_:
     case Opcode::pow_:
     case Opcode::sub_:
+    case Opcode::add_real_:
+    case Opcode::sub_real_:
+    case Opcode::mul_real_:
+    case Opcode::div_real_:
+    case Opcode::add_int_:
+    case Opcode::sub_int_:
+    case Opcode::mul_int_:
+    case Opcode::add_int_unchecked_:
+    case Opcode::sub_int_unchecked_:
+    case Opcode::mul_int_unchecked_:
     case Opcode::uplus_:
     case Opcode::uminus_:
     case Opcode::not_:
@@ -357,9 +425,13 @@ void BC::print(CallSite* cs) {
         break;
     }
     case Opcode::push_:
+    case Opcode::lazy_:
         Rprintf(" %u # ", immediate.pool);
         Rf_PrintValue(immediateConst());
         return;
+    case Opcode::run_lazy_:
+        Rprintf(" %u", immediate.pool);
+        break;
     case Opcode::ldarg_:
     case Opcode::ldfun_:
     case Opcode::ldvar_:
@@ -368,6 +440,7 @@ void BC::print(CallSite* cs) {
     case Opcode::ldddvar_:
     case Opcode::stvar_:
     case Opcode::stvar2_:
+    case Opcode::clear_:
     case Opcode::missing_:
         Rprintf(" %u # %s", immediate.pool, CHAR(PRINTNAME((immediateConst()))));
         break;
@@ -399,6 +472,7 @@ void BC::print(CallSite* cs) {
     case Opcode::swap_:
     case Opcode::int3_:
     case Opcode::make_unique_:
+    case Opcode::reuse_:
     case Opcode::set_shared_:
     case Opcode::dup_:
     case Opcode::inc_:
@@ -413,6 +487,16 @@ void BC::print(CallSite* cs) {
     case Opcode::mod_:
     case Opcode::pow_:
     case Opcode::sub_:
+    case Opcode::add_real_:
+    case Opcode::sub_real_:
+    case Opcode::mul_real_:
+    case Opcode::div_real_:
+    case Opcode::add_int_:
+    case Opcode::sub_int_:
+    case Opcode::mul_int_:
+    case Opcode::add_int_unchecked_:
+    case Opcode::sub_int_unchecked_:
+    case Opcode::mul_int_unchecked_:
     case Opcode::uplus_:
     case Opcode::uminus_:
     case Opcode::not_:
@@ -430,6 +514,7 @@ void BC::print(CallSite* cs) {
     case Opcode::extract2_:
     case Opcode::subset1_:
     case Opcode::extract1_:
+    case Opcode::extract1_unchecked_:
     case Opcode::close_:
     case Opcode::length_:
     case Opcode::names_:
@@ -446,9 +531,28 @@ void BC::print(CallSite* cs) {
         Rprintf(" %x", immediate.fun);
         break;
     case Opcode::beginloop_:
+    case Opcode::for_step_:
     case Opcode::brtrue_:
     case Opcode::brobj_:
     case Opcode::brfalse_:
+    case Opcode::brfalse_lt_:
+    case Opcode::brfalse_gt_:
+    case Opcode::brfalse_le_:
+    case Opcode::brfalse_ge_:
+    case Opcode::brfalse_eq_:
+    case Opcode::brfalse_ne_:
+    case Opcode::brfalse_lt_int_:
+    case Opcode::brfalse_gt_int_:
+    case Opcode::brfalse_le_int_:
+    case Opcode::brfalse_ge_int_:
+    case Opcode::brfalse_eq_int_:
+    case Opcode::brfalse_ne_int_:
+    case Opcode::brfalse_lt_real_:
+    case Opcode::brfalse_gt_real_:
+    case Opcode::brfalse_le_real_:
+    case Opcode::brfalse_ge_real_:
+    case Opcode::brfalse_eq_real_:
+    case Opcode::brfalse_ne_real_:
     case Opcode::br_:
         Rprintf(" %d", immediate.offset);
         break;
@@ -109,6 +109,11 @@ BC BC::promise(FunIdxT prom) {
     i.fun = prom;
     return BC(Opcode::promise_, i);
 }
+BC BC::lazy(SEXP ast) {
+    ImmediateT i;
+    i.pool = Pool::insert(ast);
+    return BC(Opcode::lazy_, i);
+}
 BC BC::asast() { return BC(Opcode::asast_); }
 BC BC::missing(SEXP sym) {
     assert(TYPEOF(sym) == SYMSXP);
@@ -117,6 +122,13 @@ BC BC::missing(SEXP sym) {
     i.pool = Pool::insert(sym);
     return BC(Opcode::missing_, i);
 }
+BC BC::clear(SEXP sym) {
+    assert(TYPEOF(sym) == SYMSXP);
+    assert(strlen(CHAR(PRINTNAME(sym))));
+    ImmediateT i;
+    i.pool = Pool::insert(sym);
+    return BC(Opcode::clear_, i);
+}
 BC BC::stvar(SEXP sym) {
     assert(TYPEOF(sym) == SYMSXP);
     assert(strlen(CHAR(PRINTNAME(sym))));
@@ -184,12 +196,38 @@ BC BC::brfalse(JmpT j) {
     i.offset = j;
     return BC(Opcode::brfalse_, i);
 }
+BC BC::brfalseRelop(Opcode relop, JmpT j) {
+    ImmediateT i;
+    i.offset = j;
+    switch (relop) {
+    case Opcode::lt_:
+        return BC(Opcode::brfalse_lt_, i);
+    case Opcode::gt_:
+        return BC(Opcode::brfalse_gt_, i);
+    case Opcode::le_:
+        return BC(Opcode::brfalse_le_, i);
+    case Opcode::ge_:
+        return BC(Opcode::brfalse_ge_, i);
+    case Opcode::eq_:
+        return BC(Opcode::brfalse_eq_, i);
+    case Opcode::ne_:
+        return BC(Opcode::brfalse_ne_, i);
+    default:
+        assert(false && "not a relational operator");
+        return BC(Opcode::brfalse_, i);
+    }
+}
 BC BC::endcontext() { return BC(Opcode::endcontext_); }
 BC BC::dup() { return BC(Opcode::dup_); }
 BC BC::inc() { return BC(Opcode::inc_); }
 BC BC::close() { return BC(Opcode::close_); }
 BC BC::dup2() { return BC(Opcode::dup2_); }
 BC BC::testBounds() { return BC(Opcode::test_bounds_); }
+BC BC::forStep(JmpT j) {
+    ImmediateT i;
+    i.offset = j;
+    return BC(Opcode::for_step_, i);
+}
 BC BC::add() { return BC(Opcode::add_); }
 BC BC::mul() { return BC(Opcode::mul_); }
 BC BC::div() { return BC(Opcode::div_); }
@@ -209,12 +247,65 @@ BC BC::ne() { return BC(Opcode::ne_); }
 BC BC::invisible() { return BC(Opcode::invisible_); }
 BC BC::visible() { return BC(Opcode::visible_); }
 BC BC::extract1() { return BC(Opcode::extract1_); }
+BC BC::extract1Unchecked() { return BC(Opcode::extract1_unchecked_); }
+// The variant of an arithmetic instruction or fused comparison for operands
+// which are both scalars of the given type, or generic if there is none
+BC BC::specialize(BC generic, SEXPTYPE scalars) {
+    assert(scalars == INTSXP || scalars == REALSXP);
+    bool i = scalars == INTSXP;
+    switch (generic.bc) {
+    case Opcode::add_:
+        return BC(i ? Opcode::add_int_ : Opcode::add_real_);
+    case Opcode::sub_:
+        return BC(i ? Opcode::sub_int_ : Opcode::sub_real_);
+    case Opcode::mul_:
+        return BC(i ? Opcode::mul_int_ : Opcode::mul_real_);
+    case Opcode::div_:
+        // int / int is a double
+        return i ? generic : BC(Opcode::div_real_);
+    case Opcode::brfalse_lt_:
+        return BC(i ? Opcode::brfalse_lt_int_ : Opcode::brfalse_lt_real_,
+                  generic.immediate);
+    case Opcode::brfalse_gt_:
+        return BC(i ? Opcode::brfalse_gt_int_ : Opcode::brfalse_gt_real_,
+                  generic.immediate);
+    case Opcode::brfalse_le_:
+        return BC(i ? Opcode::brfalse_le_int_ : Opcode::brfalse_le_real_,
+                  generic.immediate);
+    case Opcode::brfalse_ge_:
+        return BC(i ? Opcode::brfalse_ge_int_ : Opcode::brfalse_ge_real_,
+                  generic.immediate);
+    case Opcode::brfalse_eq_:
+        return BC(i ? Opcode::brfalse_eq_int_ : Opcode::brfalse_eq_real_,
+                  generic.immediate);
+    case Opcode::brfalse_ne_:
+        return BC(i ? Opcode::brfalse_ne_int_ : Opcode::brfalse_ne_real_,
+                  generic.immediate);
+    default:
+        return generic;
+    }
+}
+
+// The variant of an integer instruction without the NA and overflow checks
+BC BC::uncheckedInt(BC typed) {
+    switch (typed.bc) {
+    case Opcode::add_int_:
+        return BC(Opcode::add_int_unchecked_);
+    case Opcode::sub_int_:
+        return BC(Opcode::sub_int_unchecked_);
+    case Opcode::mul_int_:
+        return BC(Opcode::mul_int_unchecked_);
+    default:
+        return typed;
+    }
+}
 BC BC::subset1() { return BC(Opcode::subset1_); }
 BC BC::extract2() { return BC(Opcode::extract2_); }
 BC BC::subset2() { return BC(Opcode::subset2_); }
 BC BC::swap() { return BC(Opcode::swap_); }
 BC BC::int3() { return BC(Opcode::int3_); }
 BC BC::makeUnique() { return BC(Opcode::make_unique_); }
+BC BC::reuse() { return BC(Opcode::reuse_); }
 BC BC::setShared() { return BC(Opcode::set_shared_); }
 BC BC::asLogical() { return BC(Opcode::aslogical_); }
 BC BC::lglAnd() { return BC(Opcode::lgl_and_); }
@@ -181,7 +181,39 @@ class BC {
 
     bool isCondJmp() const {
         return bc == Opcode::brtrue_ || bc == Opcode::brfalse_ ||
-               bc == Opcode::brobj_ || bc == Opcode::beginloop_;
+               bc == Opcode::brobj_ || bc == Opcode::beginloop_ ||
+               bc == Opcode::for_step_ || isRelopJmp();
+    }
+
+    bool isRelopJmp() const {
+        switch (bc) {
+        case Opcode::brfalse_lt_:
+        case Opcode::brfalse_gt_:
+        case Opcode::brfalse_le_:
+        case Opcode::brfalse_ge_:
+        case Opcode::brfalse_eq_:
+        case Opcode::brfalse_ne_:
+        case Opcode::brfalse_lt_int_:
+        case Opcode::brfalse_gt_int_:
+        case Opcode::brfalse_le_int_:
+        case Opcode::brfalse_ge_int_:
+        case Opcode::brfalse_eq_int_:
+        case Opcode::brfalse_ne_int_:
+        case Opcode::brfalse_lt_real_:
+        case Opcode::brfalse_gt_real_:
+        case Opcode::brfalse_le_real_:
+        case Opcode::brfalse_ge_real_:
+        case Opcode::brfalse_eq_real_:
+        case Opcode::brfalse_ne_real_:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    bool isRelop() const {
+        return bc == Opcode::lt_ || bc == Opcode::gt_ || bc == Opcode::le_ ||
+               bc == Opcode::ge_ || bc == Opcode::eq_ || bc == Opcode::ne_;
     }
 
     bool isUncondJmp() const {
@@ -230,6 +262,7 @@ class BC {
     inline static BC ldarg(SEXP sym);
     inline static BC ldddvar(SEXP sym);
     inline static BC promise(FunIdxT prom);
+    inline static BC lazy(SEXP ast);
     inline static BC ret();
     inline static BC pop();
     inline static BC force();
@@ -237,6 +270,7 @@ class BC {
     inline static BC stvar(SEXP sym);
     inline static BC stvar2(SEXP sym);
     inline static BC missing(SEXP sym);
+    inline static BC clear(SEXP sym);
     inline static BC subassign();
     inline static BC subassign2(SEXP sym);
     inline static BC length();
@@ -248,12 +282,14 @@ class BC {
     inline static BC endcontext();
     inline static BC brtrue(JmpT);
     inline static BC brfalse(JmpT);
+    inline static BC brfalseRelop(Opcode relop, JmpT);
     inline static BC br(JmpT);
     inline static BC brobj(JmpT);
     inline static BC label(JmpT);
     inline static BC dup();
     inline static BC dup2();
     inline static BC testBounds();
+    inline static BC forStep(JmpT);
     inline static BC inc();
     inline static BC close();
     inline static BC add();
@@ -275,6 +311,7 @@ class BC {
     inline static BC seq();
     inline static BC colon();
     inline static BC makeUnique();
+    inline static BC reuse();
     inline static BC setShared();
     inline static BC asLogical();
     inline static BC lglOr();
@@ -286,6 +323,9 @@ class BC {
     inline static BC invisible();
     inline static BC visible();
     inline static BC extract1();
+    inline static BC extract1Unchecked();
+    inline static BC specialize(BC generic, SEXPTYPE scalars);
+    inline static BC uncheckedInt(BC typed);
     inline static BC subset1();
     inline static BC extract2();
     inline static BC subset2();
@@ -386,8 +426,11 @@ class BC {
         case Opcode::ldddvar_:
         case Opcode::stvar_:
         case Opcode::stvar2_:
+        case Opcode::clear_:
         case Opcode::missing_:
         case Opcode::subassign2_:
+        case Opcode::lazy_:
+        case Opcode::run_lazy_:
             immediate.pool = *(PoolIdxT*)pc;
             break;
         case Opcode::dispatch_stack_:
@@ -411,8 +454,27 @@ class BC {
         case Opcode::brtrue_:
         case Opcode::brobj_:
         case Opcode::brfalse_:
+        case Opcode::brfalse_lt_:
+        case Opcode::brfalse_gt_:
+        case Opcode::brfalse_le_:
+        case Opcode::brfalse_ge_:
+        case Opcode::brfalse_eq_:
+        case Opcode::brfalse_ne_:
+        case Opcode::brfalse_lt_int_:
+        case Opcode::brfalse_gt_int_:
+        case Opcode::brfalse_le_int_:
+        case Opcode::brfalse_ge_int_:
+        case Opcode::brfalse_eq_int_:
+        case Opcode::brfalse_ne_int_:
+        case Opcode::brfalse_lt_real_:
+        case Opcode::brfalse_gt_real_:
+        case Opcode::brfalse_le_real_:
+        case Opcode::brfalse_ge_real_:
+        case Opcode::brfalse_eq_real_:
+        case Opcode::brfalse_ne_real_:
         case Opcode::label:
         case Opcode::beginloop_:
+        case Opcode::for_step_:
             immediate.offset = *(JmpT*)pc;
             break;
         case Opcode::pick_:
@@ -425,6 +487,7 @@ class BC {
         case Opcode::nop_:
         case Opcode::test_bounds_:
         case Opcode::extract1_:
+        case Opcode::extract1_unchecked_:
         case Opcode::subset1_:
         case Opcode::extract2_:
         case Opcode::subset2_:
@@ -439,6 +502,7 @@ class BC {
         case Opcode::swap_:
         case Opcode::int3_:
         case Opcode::make_unique_:
+        case Opcode::reuse_:
         case Opcode::set_shared_:
         case Opcode::aslogical_:
         case Opcode::lgl_and_:
@@ -453,6 +517,16 @@ class BC {
         case Opcode::seq_:
         case Opcode::colon_:
         case Opcode::sub_:
+        case Opcode::add_real_:
+        case Opcode::sub_real_:
+        case Opcode::mul_real_:
+        case Opcode::div_real_:
+        case Opcode::add_int_:
+        case Opcode::sub_int_:
+        case Opcode::mul_int_:
+        case Opcode::add_int_unchecked_:
+        case Opcode::sub_int_unchecked_:
+        case Opcode::mul_int_unchecked_:
         case Opcode::uplus_:
         case Opcode::uminus_:
         case Opcode::not_:
@@ -5,12 +5,16 @@
 #include "BC.h"
 #include "CodeStream.h"
 #include "analysis/dataflow.h"
+#include "analysis_framework/manager.h"
 
 #include <iomanip>
 #include <iostream>
 
 namespace rir {
 
+constexpr CodeEditor::NodeId CodeEditor::none;
+constexpr CodeEditor::NodeId CodeEditor::front;
+
 std::unordered_set<CodeEditor::Iterator> CodeEditor::next(CodeEditor::Iterator ins) {
     std::unordered_set<CodeEditor::Iterator> result;
     if (isExitPoint(ins))
@@ -88,32 +92,35 @@ void CodeEditor::loadCode(Function* function, Code* code,
         }
     }
 
-    labels_.resize(labels_.size() + bcLabels.size());
+    labels_.resize(labels_.size() + bcLabels.size(), none);
 
     {
-        BytecodeList* pos = & front;
+        // Nodes are created in order, front is at index 0
+        nodes.reserve(code->codeSize / 2 + bcLabels.size() + 2);
+        nodes.emplace_back();
+        NodeId pos = front;
 
         Opcode* pc = code->code();
         Opcode* end = code->endCode();
 
         while (pc != end) {
-            pos->next = new BytecodeList(pc);
-            auto prev = pos;
-            pos = pos->next;
-            pos->prev = prev;
+            NodeId next = mkNode(BytecodeList(pc));
+            nodes[pos].next = next;
+            nodes[next].prev = pos;
+            pos = next;
 
             if (bcLabels.count(pc)) {
                 LabelT label = bcLabels[pc];
-                pos->bc = BC::label(label);
+                nodes[pos].bc = BC::label(label);
                 labels_[label] = pos;
 
-                pos->next = new BytecodeList();
-                auto prev = pos;
-                pos = pos->next;
-                pos->prev = prev;
+                NodeId next = mkNode(BytecodeList());
+                nodes[pos].next = next;
+                nodes[next].prev = pos;
+                pos = next;
             }
 
-            pos->srcIdx = code->getSrcIdxAt(pc, true);
+            nodes[pos].srcIdx = code->getSrcIdxAt(pc, true);
 
             BC bc = BC::advance(&pc);
             if (bc.isJmp()) {
@@ -123,12 +130,8 @@ void CodeEditor::loadCode(Function* function, Code* code,
             }
 
             // If this is a call, we copy the callsite information locally
-            if (bc.isCallsite()) {
-                auto oldCs = bc.callSite(code);
-                unsigned needed = oldCs->size();
-                pos->callSite = (CallSite*)new char[needed];
-                memcpy(pos->callSite, oldCs, needed);
-            }
+            if (bc.isCallsite())
+                nodes[pos].callSite = copyCallSite(bc.callSite(code));
             if (bc.hasPromargs()) {
                 if (bc.bc == Opcode::promise_ || bc.bc == Opcode::push_code_) {
                     Code* code = function->codeAt(bc.immediate.fun);
@@ -146,7 +149,7 @@ void CodeEditor::loadCode(Function* function, Code* code,
                     auto oldCs = bc.callSite(code);
                     auto nargs = oldCs->nargs;
 
-                    CallSite* cs = pos->callSite;
+                    CallSite* cs = nodes[pos].callSite;
                     assert(cs->nargs == oldCs->nargs);
 
                     // Load all code objects of the callsite and update
@@ -167,30 +170,86 @@ void CodeEditor::loadCode(Function* function, Code* code,
                 }
             }
 
-            pos->bc = bc;
+            nodes[pos].bc = bc;
         }
 
-        last.prev = pos;
-        pos->next = & last;
+        last = mkNode(BytecodeList());
+        nodes[last].prev = pos;
+        nodes[pos].next = last;
     }
 }
 
 CodeEditor::~CodeEditor() {
     for (auto p : promises)
         delete p;
+    delete analyses_;
+}
+
+AnalysisManager& CodeEditor::analyses() {
+    if (!analyses_)
+        analyses_ = new AnalysisManager(*this);
+    return *analyses_;
+}
+
+void CodeEditor::commit() {
+    // Without changes the nodes are still laid out in order, keep them (and
+    // the analyses computed for them)
+    if (!changed) {
+        verify();
+        return;
+    }
+
+    verify();
+
+    // Step 1: collect the live instructions in the order of the edited stream
+    // and find the labels which are still jumped to
+    std::vector<NodeId> order;
+    order.reserve(nodes.size());
+    std::vector<bool> usedLabels(labels_.size(), false);
+    auto collect = [&](NodeId pos) {
+        if (nodes[pos].deleted)
+            return;
+        BC bc = nodes[pos].bc;
+        if (bc.isJmp())
+            usedLabels[bc.immediate.offset] = true;
+        order.push_back(pos);
+    };
+    for (NodeId pos = nodes[front].next; pos != last; pos = nodes[pos].next) {
+        collect(pos);
+        for (NodeId p = nodes[pos].patch; p != none; p = nodes[p].next)
+            collect(p);
+    }
 
-    BytecodeList* pos = front.next;
-    while (pos != & last) {
-        BytecodeList* patch = pos->patch;
-        while (patch) {
-            BytecodeList* old = patch;
-            patch = patch->next;
-            delete old;
+    // Step 2: lay them out in order, dropping unused labels
+    std::vector<BytecodeList> compacted;
+    compacted.reserve(order.size() + 2);
+    compacted.emplace_back();
+    for (NodeId pos : order) {
+        BC bc = nodes[pos].bc;
+        if (bc.is(Opcode::label)) {
+            if (!usedLabels[bc.immediate.offset]) {
+                labels_[bc.immediate.offset] = none;
+                continue;
+            }
+            labels_[bc.immediate.offset] = compacted.size();
         }
-        BytecodeList* old = pos;
-        pos = pos->next;
-        delete old;
+        compacted.push_back(nodes[pos]);
+    }
+    compacted.emplace_back();
+
+    NodeId size = compacted.size();
+    for (NodeId i = 0; i < size; ++i) {
+        auto& n = compacted[i];
+        n.prev = i == 0 ? none : i - 1;
+        n.next = i == size - 1 ? none : i + 1;
+        n.patch = none;
     }
+    nodes.swap(compacted);
+    last = size - 1;
+    ++version_;
+
+    verify();
+    changed = false;
 }
 
 void CodeEditor::print(bool verbose) {
@@ -279,10 +338,10 @@ void CodeEditor::print(bool verbose) {
 }
 
 void CodeEditor::Cursor::print() {
-    if (pos->callSite)
-        pos->bc.print(callSite());
+    if (node().callSite)
+        node().bc.print(callSite());
     else
-        pos->bc.print();
+        node().bc.print();
 }
 
 unsigned CodeEditor::write(FunctionWriter& function, bool isDefaultArgument) {
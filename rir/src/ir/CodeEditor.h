@@ -4,6 +4,7 @@
 #include "BC_inc.h"
 
 #include "interpreter/interp_context.h"
+#include "utils/Arena.h"
 #include "utils/FunctionWriter.h"
 
 #include <unordered_set>
@@ -17,6 +18,8 @@
 
 namespace rir {
 
+class AnalysisManager;
+
 class CodeEditor {
   private:
     /*
@@ -39,38 +42,55 @@ class CodeEditor {
      *
      * To make the changes available to further analysis, you have to commit()
      * them.
+     *
+     * All nodes live in one vector and are linked by their index. Loading and
+     * committing lay out the instructions in order, such that the unmodified
+     * stream is contiguous and patches are appended at the end. Call sites
+     * are copied into an arena owned by the editor. Committing renumbers the
+     * nodes, which invalidates all iterators and cursors.
      */
 
-#pragma pack(push)
-#pragma pack(1)
+    typedef uint32_t NodeId;
+    static constexpr NodeId none = (NodeId)-1;
+
     struct BytecodeList {
         BytecodeList() {}
         explicit BytecodeList(Opcode* pos) : origin(pos) {}
-        BytecodeList(BC bc, BytecodeList* prev, BytecodeList* next)
-            : bc(bc), prev(prev), next(next) {}
+        explicit BytecodeList(BC bc) : bc(bc) {}
 
-        bool deleted = false;
-        Opcode* origin = nullptr;
         BC bc;
-        unsigned srcIdx = 0;
+        Opcode* origin = nullptr;
         CallSite* callSite = nullptr;
-        BytecodeList* prev = nullptr;
-        BytecodeList* next = nullptr;
-        BytecodeList* patch = nullptr;
+        unsigned srcIdx = 0;
+        NodeId prev = none;
+        NodeId next = none;
+        NodeId patch = none;
+        bool deleted = false;
 
         SEXP src() const {
             return srcIdx != 0 ? src_pool_at(globalContext(), srcIdx) : 0;
         }
-
-        ~BytecodeList() {
-            if (callSite)
-                delete[] callSite;
-        }
     };
-#pragma pack(pop)
 
-    BytecodeList front;
-    BytecodeList last;
+    // front sentinel, the instructions start at index 1
+    static constexpr NodeId front = 0;
+    // end sentinel, the nodes after it are patches
+    NodeId last;
+
+    std::vector<BytecodeList> nodes;
+    Arena callSites;
+
+    NodeId mkNode(BytecodeList node) {
+        nodes.push_back(node);
+        return nodes.size() - 1;
+    }
+
+    CallSite* copyCallSite(CallSite* cs) {
+        unsigned needed = cs->size();
+        CallSite* res = (CallSite*)callSites.alloc(needed);
+        memcpy(res, cs, needed);
+        return res;
+    }
 
     std::vector<CodeEditor*> promises;
     std::vector<unsigned> defaultArguments;  // indices of promises that are compiled
@@ -78,7 +98,11 @@ class CodeEditor {
 
     SEXP ast;
 
-    std::vector<BytecodeList*> labels_;
+    std::vector<NodeId> labels_;
+
+    // incremented by every commit that changes the code
+    unsigned version_ = 0;
+    AnalysisManager* analyses_ = nullptr;
 
   public:
     class Cursor;
@@ -87,24 +111,33 @@ class CodeEditor {
     // changes made to the instruction stream.
     class Iterator {
       protected:
-        const BytecodeList* pos;
+        const CodeEditor* editor;
+        NodeId pos;
         friend class CodeEditor;
 
+        const BytecodeList& node() const { return editor->nodes[pos]; }
+
       public:
-        Iterator() : pos(nullptr) {}
-        Iterator(const BytecodeList* pos) : pos(pos) {}
-        Iterator(const Iterator& other) : pos(other.pos) {}
-        Iterator(int fake) : pos(reinterpret_cast<const BytecodeList*>(fake)) {}
+        Iterator() : editor(nullptr), pos(none) {}
+        Iterator(const CodeEditor* editor, NodeId pos)
+            : editor(editor), pos(pos) {}
+        Iterator(const Iterator& other) = default;
+        Iterator& operator=(const Iterator& other) = default;
+        Iterator(int fake) : editor(nullptr), pos((NodeId)fake) {}
 
-        BC operator*() const { return pos->bc; }
+        BC operator*() const { return node().bc; }
 
-        void operator++() { pos = pos->next; }
-        void operator--() { pos = pos->prev; }
+        void operator++() { pos = node().next; }
+        void operator--() { pos = node().prev; }
 
         Iterator operator+(int num) {
             if (num < 0)
                 return *this - (-num);
 
+            // the unmodified stream is stored in order
+            if (pos <= editor->last && editor->last - pos >= (NodeId)num)
+                return Iterator(editor, pos + num);
+
             Iterator n = *this;
             for (int i = 0; i < num; ++i)
                 ++n;
@@ -115,6 +148,9 @@ class CodeEditor {
             if (num < 0)
                 return *this + (-num);
 
+            if (pos <= editor->last && pos >= (NodeId)num)
+                return Iterator(editor, pos - num);
+
             Iterator n = *this;
             for (int i = 0; i < num; ++i)
                 --n;
@@ -122,29 +158,30 @@ class CodeEditor {
         }
 
         bool operator==(const Iterator& other) const {
-            return pos == other.pos;
+            return pos == other.pos && editor == other.editor;
         }
 
         bool operator!=(const Iterator& other) const {
-            return pos != other.pos;
+            return pos != other.pos || editor != other.editor;
         }
 
         unsigned long hash() const {
-            return std::hash<unsigned long>()((unsigned long)pos);
+            return std::hash<unsigned long>()((unsigned long)editor) ^
+                   std::hash<unsigned long>()(pos);
         }
 
-        SEXP src() const { return pos->src(); }
+        SEXP src() const { return node().src(); }
 
-        CallSite* callSite() const { return pos->callSite; }
+        CallSite* callSite() const { return node().callSite; }
 
-        bool hasOrigin() { return pos->origin; }
+        bool hasOrigin() { return node().origin; }
 
         Opcode* origin() {
-            assert(pos->origin);
-            return pos->origin;
+            assert(node().origin);
+            return node().origin;
         }
 
-        bool deleted() const { return pos->deleted; }
+        bool deleted() const { return node().deleted; }
 
         Cursor asCursor(CodeEditor& editor);
     };
@@ -152,12 +189,13 @@ class CodeEditor {
     // The cursor can insert changes into the codestream
     class Cursor {
         CodeEditor& editor;
-        BytecodeList* pos;
+        NodeId pos;
         bool inPatch = false;
 
+        BytecodeList& node() const { return editor.nodes[pos]; }
+
       public:
-        Cursor(CodeEditor& editor, BytecodeList* pos)
-            : editor(editor), pos(pos) {}
+        Cursor(CodeEditor& editor, NodeId pos) : editor(editor), pos(pos) {}
 
         Cursor(Cursor const & from):
             editor(from.editor),
@@ -173,30 +211,33 @@ class CodeEditor {
             return pos != other.pos or &editor != &other.editor;
         }
 
-        Iterator asItr() { return Iterator(pos); }
+        Iterator asItr() { return Iterator(&editor, pos); }
 
-        bool atEnd() const { return pos == &editor.last; }
-        bool firstInstruction() const { return pos == editor.front.next; }
+        bool atEnd() const { return pos == editor.last; }
+        bool firstInstruction() const {
+            return pos == editor.nodes[front].next;
+        }
 
         Cursor& advance() {
             assert(!atEnd());
+            auto& nodes = editor.nodes;
             do {
-                if (pos->patch) {
-                    pos = pos->patch;
+                if (nodes[pos].patch != none) {
+                    pos = nodes[pos].patch;
                     inPatch = true;
                 } else {
-                    if (pos->next) {
-                        pos = pos->next;
+                    if (nodes[pos].next != none) {
+                        pos = nodes[pos].next;
                     } else {
                         // At the end of the patch we rewind and go to the next
                         // instruction
-                        while (!pos->patch)
-                            pos = pos->prev;
-                        pos = pos->next;
+                        while (nodes[pos].patch == none)
+                            pos = nodes[pos].prev;
+                        pos = nodes[pos].next;
                         inPatch = false;
                     }
                 }
-            } while (pos->deleted && !atEnd());
+            } while (nodes[pos].deleted && !atEnd());
             return *this;
         }
 
@@ -206,23 +247,24 @@ class CodeEditor {
         }
 
         Cursor& rwd() {
+            auto& nodes = editor.nodes;
             do {
                 assert(!firstInstruction());
                 auto oldPos = pos;
-                pos = pos->prev;
-                if (pos->patch) {
+                pos = nodes[pos].prev;
+                if (nodes[pos].patch != none) {
                     // Now we need to figure out if we came backwards from the
                     // patch, or from the other instruction stream
-                    if (oldPos == pos->patch) {
+                    if (oldPos == nodes[pos].patch) {
                         inPatch = false;
                     } else {
-                        pos = pos->patch;
-                        while (pos->next)
-                            pos = pos->next;
+                        pos = nodes[pos].patch;
+                        while (nodes[pos].next != none)
+                            pos = nodes[pos].next;
                         inPatch = true;
                     }
                 }
-            } while (pos->deleted && !firstInstruction());
+            } while (nodes[pos].deleted && !firstInstruction());
             return *this;
         }
 
@@ -232,13 +274,13 @@ class CodeEditor {
         }
 
         BC bc() const {
-            return pos->bc;
+            return node().bc;
         }
 
-        SEXP src() const { return pos->src(); }
-        unsigned srcIdx() const { return pos->srcIdx; }
+        SEXP src() const { return node().src(); }
+        unsigned srcIdx() const { return node().srcIdx; }
 
-        CallSite* callSite() { return pos->callSite; }
+        CallSite* callSite() { return node().callSite; }
 
         // TODO this breaks when inserting before the first instruction....
         Cursor& operator<<(LabelT l) { return *this << BC::label(l); }
@@ -247,52 +289,63 @@ class CodeEditor {
             editor.changed = true;
 
             bool nextInPatch = inPatch;
-            BytecodeList* next = pos;
+            NodeId next = pos;
 
             Cursor p = prev();
             bool prevInPatch = p.inPatch;
-            BytecodeList* prev = p.pos;
-            BytecodeList* insert = nullptr;
+            NodeId prev = p.pos;
+            NodeId insert = editor.mkNode(BytecodeList(bc));
+            auto& nodes = editor.nodes;
 
             if (prevInPatch && nextInPatch) {
                 // Insert in the middle of a patch
-                insert = new BytecodeList(bc, prev, next);
-                prev->next = insert;
-                next->prev = insert;
+                nodes[insert].prev = prev;
+                nodes[insert].next = next;
+                nodes[prev].next = insert;
+                nodes[next].prev = insert;
             }
             if (prevInPatch && !nextInPatch) {
                 // insert at the end of a patch
-                insert = new BytecodeList(bc, prev, nullptr);
-                prev->next = insert;
+                nodes[insert].prev = prev;
+                nodes[prev].next = insert;
             }
             if (!prevInPatch && nextInPatch) {
                 // insert at the beginning of a patch
-                auto oldPatch = prev->patch;
-                insert = new BytecodeList(bc, prev, oldPatch);
-                prev->patch = insert;
-                oldPatch->prev = insert;
+                auto oldPatch = nodes[prev].patch;
+                nodes[insert].prev = prev;
+                nodes[insert].next = oldPatch;
+                nodes[prev].patch = insert;
+                nodes[oldPatch].prev = insert;
             }
             if (!prevInPatch && !nextInPatch) {
                 // create a new patch
-                insert = new BytecodeList(bc, prev, nullptr);
-                prev->patch = insert;
+                nodes[insert].prev = prev;
+                nodes[prev].patch = insert;
             }
 
             if (bc.bc == Opcode::label)
-                editor.labels_[insert->bc.immediate.offset] = insert;
+                editor.labels_[bc.immediate.offset] = insert;
 
             pos = next;
             return *this;
         }
 
+        // Attaches a source index to the instruction inserted last
+        void addSrcIdx(unsigned idx) {
+            BytecodeList& insert = prev().node();
+            assert(!insert.srcIdx);
+            insert.srcIdx = idx;
+        }
+
         void insert(CodeEditor& other) {
             editor.changed = true;
 
             // Merge labels
             std::unordered_map<FunIdxT, FunIdxT> labelRewrite;
             for (auto l : other.labels_)
-                if (l)
-                    labelRewrite[l->bc.immediate.offset] = editor.mkLabel();
+                if (l != none)
+                    labelRewrite[other.nodes[l].bc.immediate.offset] =
+                        editor.mkLabel();
 
             // Merge promises
             size_t proms = editor.promises.size();
@@ -326,27 +379,23 @@ class CodeEditor {
 
                 *this << *cur;
 
-                BytecodeList* insert = prev().pos;
+                BytecodeList& insert = prev().node();
 
-                insert->srcIdx = cur.pos->srcIdx;
+                insert.srcIdx = cur.node().srcIdx;
 
                 if (first) {
-                    if (!insert->srcIdx)
-                        insert->srcIdx =
+                    if (!insert.srcIdx)
+                        insert.srcIdx =
                             src_pool_add(globalContext(), other.ast);
                     first = false;
                 }
 
-                if ((*cur).isCallsite()) {
-                    auto oldCs = cur.callSite();
-                    unsigned needed = oldCs->size();
-                    insert->callSite = (CallSite*)new char[needed];
-                    memcpy(insert->callSite, oldCs, needed);
-                }
+                if ((*cur).isCallsite())
+                    insert.callSite = editor.copyCallSite(cur.callSite());
                 // Fix prom offsets
-                if (insert->bc.bc == Opcode::call_ ||
-                    insert->bc.bc == Opcode::dispatch_) {
-                    auto cs = insert->callSite;
+                if (insert.bc.bc == Opcode::call_ ||
+                    insert.bc.bc == Opcode::dispatch_) {
+                    auto cs = insert.callSite;
                     for (unsigned i = 0; i < cs->nargs; ++i) {
                         auto idx = cs->args()[i];
                         if (idx > MAX_ARG_IDX)
@@ -360,23 +409,23 @@ class CodeEditor {
                                editor.promises[idx]);
                         cs->args()[i] = idx;
                     }
-                } else if (insert->bc.bc == Opcode::promise_ ||
-                           insert->bc.bc == Opcode::push_code_) {
-                    auto idx = insert->bc.immediate.fun;
+                } else if (insert.bc.bc == Opcode::promise_ ||
+                           insert.bc.bc == Opcode::push_code_) {
+                    auto idx = insert.bc.immediate.fun;
                     if (duplicate.count(idx))
                         idx = duplicate.at(idx);
                     else
                         idx += proms;
                     assert(editor.promises.size() > idx &&
                            editor.promises[idx]);
-                    insert->bc.immediate.fun = idx;
+                    insert.bc.immediate.fun = idx;
                 } else {
-                    assert(!insert->bc.hasPromargs());
+                    assert(!insert.bc.hasPromargs());
                 }
                 // Adjust jmp targets
-                if (insert->bc.isJmp()) {
-                    insert->bc.immediate.offset =
-                        labelRewrite.at(insert->bc.immediate.offset);
+                if (insert.bc.isJmp()) {
+                    insert.bc.immediate.offset =
+                        labelRewrite.at(insert.bc.immediate.offset);
                 }
             }
         }
@@ -385,33 +434,33 @@ class CodeEditor {
             editor.changed = true;
 
             assert(!atEnd());
-            assert(pos != &editor.front);
+            assert(pos != front);
 
-            pos->deleted = true;
+            node().deleted = true;
 
             advance();
         }
 
-        bool empty() { return editor.front.next == &editor.last; }
+        bool empty() { return editor.nodes[front].next == editor.last; }
 
         void print();
 
         unsigned long hash() const {
             return std::hash<unsigned long>()((unsigned long)&editor) ^
-                   std::hash<unsigned long>()((unsigned long)pos);
+                   std::hash<unsigned long>()(pos);
         }
     };
     friend class Cursor;
 
-    Cursor getCursor() { return Cursor(*this, front.next); }
+    Cursor getCursor() { return Cursor(*this, nodes[front].next); }
 
-    Iterator begin() const { return Iterator(front.next); }
+    Iterator begin() const { return Iterator(this, nodes[front].next); }
 
-    Iterator end() const { return Iterator(&last); }
+    Iterator end() const { return Iterator(this, last); }
 
-    Iterator rbegin() const { return Iterator(last.prev); }
+    Iterator rbegin() const { return Iterator(this, nodes[last].prev); }
 
-    Iterator rend() const { return Iterator(&front); }
+    Iterator rend() const { return Iterator(this, front); }
 
     bool isEntryPoint(Iterator ins) const { return ins == begin(); }
 
@@ -485,13 +534,20 @@ class CodeEditor {
         return e;
     }
 
+    /** Replaces the promise at idx by e, which we own from now on.
+     */
+    void replacePromise(FunIdxT idx, CodeEditor* e) {
+        delete promises[idx];
+        promises[idx] = e;
+    }
+
     /** Returns cursor that points to given label.
      */
     Iterator target(BC bc) {
         assert(bc.isJmp());
         size_t index = bc.immediate.offset;
         assert (index < labels_.size());
-        return Iterator(labels_[index]);
+        return Iterator(this, labels_[index]);
     }
 
     Iterator target(Iterator ins) {
@@ -505,7 +561,7 @@ class CodeEditor {
     }
 
     LabelT mkLabel() {
-        labels_.push_back(0);
+        labels_.push_back(none);
         return labels_.size() - 1;
     }
 
@@ -518,91 +574,60 @@ class CodeEditor {
         return promises[index];
     }
 
+    /** Number of compiled default arguments, in the order of the formals.
+     */
+    size_t numDefaultArguments() const { return defaultArguments.size(); }
+
+    /** Index of the promise holding the n-th compiled default argument.
+     */
+    unsigned defaultArgument(size_t n) const {
+        assert(n < defaultArguments.size());
+        return defaultArguments[n];
+    }
+
     void verify() {
         std::set<int> labels;
-        BytecodeList* pos = front.next;
-        while (pos != &last) {
-            if (pos->patch) {
-                BytecodeList* patch = pos->patch;
-                while (patch) {
-                    assert(patch != &last);
-                    assert(patch->patch == nullptr);
-                    patch = patch->next;
+        NodeId pos = nodes[front].next;
+        while (pos != last) {
+            if (nodes[pos].patch != none) {
+                NodeId patch = nodes[pos].patch;
+                while (patch != none) {
+                    assert(patch != last);
+                    assert(nodes[patch].patch == none);
+                    patch = nodes[patch].next;
                 }
             }
-            if (pos->bc.isJmp())
-                target(pos->bc);
-            if (pos->bc.is(Opcode::label)) {
-                assert(labels.find(pos->bc.immediate.offset) == labels.end() &&
+            BC bc = nodes[pos].bc;
+            if (bc.isJmp())
+                target(bc);
+            if (bc.is(Opcode::label)) {
+                assert(labels.find(bc.immediate.offset) == labels.end() &&
                        "Label is used multiple times");
-                assert(labels_[pos->bc.immediate.offset] && "Label is unknown");
-                labels.insert(pos->bc.immediate.offset);
+                assert(labels_[bc.immediate.offset] != none &&
+                       "Label is unknown");
+                labels.insert(bc.immediate.offset);
             }
-            pos = pos->next;
+            pos = nodes[pos].next;
         }
     }
 
-    void commit() {
-        verify();
-
-        // Step 1: splice patches
-        BytecodeList* pos = front.next;
-        while (pos != &last) {
-            if (pos->patch) {
-                BytecodeList* next = pos->next;
-                BytecodeList* patchEnd = pos->patch;
-                while (patchEnd->next)
-                    patchEnd = patchEnd->next;
-                pos->next = pos->patch;
-                pos->patch = nullptr;
-                patchEnd->next = next;
-                next->prev = patchEnd;
-                pos = patchEnd;
-            } else {
-                pos = pos->next;
-            }
-        }
+    void commit();
 
-        std::set<BytecodeList*> usedLabels;
-
-        // Step 2: remove deleted
-        pos = front.next;
-        while (pos != &last) {
-            if (pos->deleted) {
-                pos->prev->next = pos->next;
-                pos->next->prev = pos->prev;
-                BytecodeList* old = pos;
-                pos = pos->next;
-                delete old;
-            } else {
-                if (pos->bc.isJmp()) {
-                    usedLabels.insert(
-                        const_cast<BytecodeList*>(target(pos->bc).pos));
-                }
-                pos = pos->next;
-            }
-        }
-
-        for (auto l = labels_.begin(); l != labels_.end(); ++l) {
-            auto oldL = *l;
-            if (oldL && usedLabels.find(oldL) == usedLabels.end()) {
-                oldL->prev->next = oldL->next;
-                oldL->next->prev = oldL->prev;
-                *l = nullptr;
-                delete oldL;
-            }
-        }
+    /** Identifies the committed state of the code. Results of analyses are
+     * valid as long as the version does not change.
+     */
+    unsigned version() const { return version_; }
 
-        verify();
-        changed = false;
-    }
+    /** The cached analyses of this code. */
+    AnalysisManager& analyses();
 
     bool changed = false;
     SEXP formals_ = nullptr;
 };
 
 inline CodeEditor::Cursor CodeEditor::Iterator::asCursor(CodeEditor& editor) {
-    return CodeEditor::Cursor(editor, const_cast<BytecodeList*>(pos));
+    assert(&editor == this->editor);
+    return CodeEditor::Cursor(editor, pos);
 }
 }
 
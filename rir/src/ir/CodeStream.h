@@ -106,6 +106,7 @@ class CodeStream {
         cs->call = Pool::insert(call);
         cs->hasProfile = false;
         cs->hasNames = hasNames;
+        cs->eagerArgs = false;
         cs->hasSelector = (bc == Opcode::dispatch_stack_);
         cs->hasTarget = (bc == Opcode::static_call_stack_);
         cs->hasImmediateArgs = false;
@@ -158,6 +159,7 @@ class CodeStream {
         cs->call = Pool::insert(call);
         cs->hasProfile = true;
         cs->hasNames = hasNames;
+        cs->eagerArgs = false;
         cs->hasSelector = (bc == Opcode::dispatch_);
         cs->hasImmediateArgs = true;
 
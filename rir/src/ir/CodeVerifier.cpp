@@ -179,8 +179,7 @@ void CodeVerifier::verifyFunctionLayout(SEXP sexp, ::Context* ctx) {
         while (true) {
             assert(cptr < end);
             BC cur = BC::decode(cptr);
-            if (*cptr == Opcode::br_ || *cptr == Opcode::brobj_ ||
-                *cptr == Opcode::brtrue_ || *cptr == Opcode::brfalse_) {
+            if (cur.isJmp()) {
                 int off = *reinterpret_cast<int*>(cptr + 1);
                 assert(cptr + off >= start && cptr + off < end);
             }
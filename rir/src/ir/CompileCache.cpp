@@ -0,0 +1,136 @@
+#include "CompileCache.h"
+
+#include "R/Protect.h"
+#include "ir/BC.h"
+#include "runtime/Function.h"
+#include "utils/Image.h"
+
+#include <cassert>
+#include <cstring>
+#include <iterator>
+
+namespace rir {
+
+std::list<CompileCache::Entry> CompileCache::lru;
+std::unordered_multimap<SEXP, CompileCache::EntryIt> CompileCache::byAst;
+std::unordered_multimap<uint64_t, CompileCache::EntryIt> CompileCache::byHash;
+std::vector<size_t> CompileCache::freeSlots;
+
+namespace {
+
+template <typename Map, typename Key, typename It>
+void eraseIt(Map& map, Key key, It e) {
+    auto range = map.equal_range(key);
+    for (auto i = range.first; i != range.second; ++i) {
+        if (i->second == e) {
+            map.erase(i);
+            return;
+        }
+    }
+    assert(false);
+}
+}
+
+// Each slot of the store holds ast, formals and fun of one entry.
+SEXP CompileCache::store() {
+    static SEXP store = nullptr;
+    if (!store) {
+        store = Rf_allocVector(VECSXP, 3 * capacity);
+        R_PreserveObject(store);
+    }
+    return store;
+}
+
+SEXP CompileCache::copy(SEXP fun) {
+    Function* from = Function::unpack(fun);
+    SEXP store = Rf_allocVector(EXTERNALSXP, pad4(from->size));
+    // it is ok to bypass the write barrier, store is a new object
+    memcpy(INTEGER(store), from, from->size);
+    Function* to = Function::unpack(store);
+
+    // no feedback and no optimized versions
+    SEXP* gcArea = (SEXP*)((uintptr_t)to + to->info.gc_area_start);
+    for (unsigned i = 1; i < to->info.gc_area_length; ++i)
+        gcArea[i] = nullptr;
+    to->invocationCount = 0;
+    to->envLeaked = false;
+    to->envChanged = false;
+    to->deopt = false;
+    to->markOpt = false;
+
+    for (Code* c : *to) {
+        c->perfCounter = 0;
+        Opcode* pc = c->code();
+        while (pc != c->endCode()) {
+            BC bc = BC::advance(&pc);
+            if (bc.isCallsite()) {
+                CallSite* cs = bc.callSite(c);
+                if (cs->hasProfile)
+                    memset(cs->profile(), 0, sizeof(CallSiteProfile));
+            }
+        }
+    }
+    return store;
+}
+
+void CompileCache::touch(EntryIt e) { lru.splice(lru.begin(), lru, e); }
+
+void CompileCache::remove(EntryIt victim) {
+    eraseIt(byAst, victim->ast, victim);
+    eraseIt(byHash, victim->hash, victim);
+    SEXP s = store();
+    for (size_t i = 0; i < 3; ++i)
+        SET_VECTOR_ELT(s, 3 * victim->slot + i, R_NilValue);
+    freeSlots.push_back(victim->slot);
+    lru.erase(victim);
+}
+
+SEXP CompileCache::get(SEXP ast, SEXP formals) {
+    EntryIt found = lru.end();
+    auto range = byAst.equal_range(ast);
+    for (auto i = range.first; i != range.second; ++i) {
+        if (i->second->formals == formals) {
+            found = i->second;
+            break;
+        }
+    }
+
+    // the same code in a different AST object (eg. a re-created closure)
+    if (found == lru.end()) {
+        auto range = byHash.equal_range(Image::hash(ast, formals));
+        for (auto i = range.first; i != range.second; ++i) {
+            if (R_compute_identical(i->second->ast, ast, 16) &&
+                R_compute_identical(i->second->formals, formals, 16)) {
+                found = i->second;
+                break;
+            }
+        }
+    }
+
+    if (found == lru.end())
+        return nullptr;
+
+    touch(found);
+    return copy(found->fun);
+}
+
+void CompileCache::put(SEXP ast, SEXP formals, SEXP fun) {
+    if (lru.size() == capacity)
+        remove(std::prev(lru.end()));
+    size_t slot = freeSlots.empty() ? lru.size() : freeSlots.back();
+    if (!freeSlots.empty())
+        freeSlots.pop_back();
+
+    Protect p;
+    fun = p(copy(fun));
+    SEXP s = store();
+    SET_VECTOR_ELT(s, 3 * slot, ast);
+    SET_VECTOR_ELT(s, 3 * slot + 1, formals);
+    SET_VECTOR_ELT(s, 3 * slot + 2, fun);
+
+    uint64_t hash = Image::hash(ast, formals);
+    lru.push_front({ast, formals, fun, hash, slot});
+    byAst.insert({ast, lru.begin()});
+    byHash.insert({hash, lru.begin()});
+}
+}
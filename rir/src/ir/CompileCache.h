@@ -0,0 +1,58 @@
+#ifndef RIR_COMPILE_CACHE_H
+#define RIR_COMPILE_CACHE_H
+
+#include "R/r.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+namespace rir {
+
+/** Remembers the Functions compiled for an AST and formals, so that eval of
+ *  the same expression, or closures re-created from the same body, do not
+ *  get compiled again.
+ *
+ *  Lookups first try the identity of the AST, then a structural hash (the
+ *  one used by Image) confirmed with identical(). The cache keeps the ASTs
+ *  and Functions alive, it is bounded and evicts the least recently used
+ *  entry.
+ *
+ *  Every closure needs its own Function, they collect invocation counts and
+ *  call site profiles and get optimized for their environment. The cache
+ *  holds a copy which never runs, and hands out fresh copies of it.
+ */
+class CompileCache {
+  public:
+    static constexpr size_t capacity = 1024;
+
+    /** Returns a copy of the cached Function container or nullptr. */
+    static SEXP get(SEXP ast, SEXP formals);
+
+    static void put(SEXP ast, SEXP formals, SEXP fun);
+
+  private:
+    struct Entry {
+        SEXP ast;
+        SEXP formals;
+        SEXP fun;
+        uint64_t hash;
+        size_t slot; /// index of the gc roots in store
+    };
+    typedef std::list<Entry>::iterator EntryIt;
+
+    static SEXP copy(SEXP fun);
+    static void touch(EntryIt e);
+    static void remove(EntryIt e);
+    static SEXP store();
+
+    static std::list<Entry> lru;
+    static std::unordered_multimap<SEXP, EntryIt> byAst;
+    static std::unordered_multimap<uint64_t, EntryIt> byHash;
+    static std::vector<size_t> freeSlots;
+};
+}
+
+#endif
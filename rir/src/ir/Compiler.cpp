@@ -165,6 +165,47 @@ void compileDispatch(Context& ctx, SEXP selector, SEXP ast, SEXP fun,
     ctx.cs().insertCall(Opcode::dispatch_, callArgs, names, ast, selector);
 }
 
+// Compiles the condition of an if or while, branching to falseBranch if it
+// does not hold. Relational operators are fused with the branch, such that
+// scalar comparisons do not have to materialize a logical vector.
+void compileCondition(Context& ctx, SEXP cond, LabelT falseBranch) {
+    CodeStream& cs = ctx.cs();
+
+    if (TYPEOF(cond) == LANGSXP && TYPEOF(CAR(cond)) == SYMSXP) {
+        SEXP fun = CAR(cond);
+        RList args(CDR(cond));
+
+        Opcode relop = Opcode::invalid_;
+        if (fun == symbol::Lt)
+            relop = Opcode::lt_;
+        else if (fun == symbol::Gt)
+            relop = Opcode::gt_;
+        else if (fun == symbol::Le)
+            relop = Opcode::le_;
+        else if (fun == symbol::Ge)
+            relop = Opcode::ge_;
+        else if (fun == symbol::Eq)
+            relop = Opcode::eq_;
+        else if (fun == symbol::Ne)
+            relop = Opcode::ne_;
+
+        if (relop != Opcode::invalid_ && args.length() == 2) {
+            cs << BC::guardNamePrimitive(fun);
+
+            compileExpr(ctx, args[0]);
+            compileExpr(ctx, args[1]);
+
+            cs << BC::brfalseRelop(relop, falseBranch);
+            cs.addSrc(cond);
+            return;
+        }
+    }
+
+    compileExpr(ctx, cond);
+    cs << BC::asbool()
+       << BC::brfalse(falseBranch);
+}
+
 // Inline some specials
 // TODO: once we have sufficiently powerful analysis this should (maybe?) go
 //       away and move to an optimization phase.
@@ -631,22 +672,21 @@ bool compileSpecialCall(Context& ctx, SEXP ast, SEXP fun, SEXP args_) {
             return false;
 
         cs << BC::guardNamePrimitive(fun);
-        LabelT trueBranch = cs.mkLabel();
+        LabelT falseBranch = cs.mkLabel();
         LabelT nextBranch = cs.mkLabel();
 
-        compileExpr(ctx, args[0]);
-        cs << BC::asbool() << BC::brtrue(trueBranch);
+        compileCondition(ctx, args[0], falseBranch);
 
+        compileExpr(ctx, args[1]);
+        cs << BC::br(nextBranch);
+
+        cs << falseBranch;
         if (args.length() < 3) {
             cs << BC::push(R_NilValue)
                << BC::invisible();
         } else {
             compileExpr(ctx, args[2]);
         }
-        cs << BC::br(nextBranch);
-
-        cs << trueBranch;
-        compileExpr(ctx, args[1]);
 
         cs << nextBranch;
         return true;
@@ -759,9 +799,7 @@ bool compileSpecialCall(Context& ctx, SEXP ast, SEXP fun, SEXP args_) {
         cs << BC::beginloop(nextBranch)
            << loopBranch;
 
-        compileExpr(ctx, cond);
-        cs << BC::asbool()
-           << BC::brfalse(nextBranch);
+        compileCondition(ctx, cond, nextBranch);
 
         compileExpr(ctx, body);
         cs << BC::pop()
@@ -850,9 +888,7 @@ bool compileSpecialCall(Context& ctx, SEXP ast, SEXP fun, SEXP args_) {
         pcs.push_back(cs.currentPos());
         cs << BC::put(2);
 
-        cs << BC::inc()
-           << BC::testBounds()
-           << BC::brfalse(endForBranch)
+        cs << BC::forStep(endForBranch)
            << BC::dup2()
            << BC::extract1();
 
@@ -1179,15 +1215,36 @@ void compileExpr(Context& ctx, SEXP exp) {
     }
 }
 
+// break and next in promises need the compiler to set up a context for the
+// enclosing loop, so they cannot be compiled lazily
+bool containsLoopJump(SEXP exp) {
+    if (TYPEOF(exp) != LANGSXP)
+        return false;
+    if (CAR(exp) == symbol::Break || CAR(exp) == symbol::Next)
+        return true;
+    for (SEXP e = exp; e != R_NilValue; e = CDR(e))
+        if (containsLoopJump(CAR(e)))
+            return true;
+    return false;
+}
+
 FunIdxT compilePromise(Context& ctx, SEXP exp, bool isFormal) {
     ctx.pushPromiseContext(exp);
-    compileExpr(ctx, exp);
+    // Calls are compiled on first force, since many promises (especially
+    // default arguments) are never forced. Symbols and constants are cheaper
+    // to compile than the stub.
+    if (TYPEOF(exp) == LANGSXP && !containsLoopJump(exp))
+        ctx.cs() << BC::lazy(exp);
+    else
+        compileExpr(ctx, exp);
     ctx.cs() << BC::ret();
     return ctx.pop(isFormal);
 }
 
 }  // anonymous namespace
 
+bool Compiler::baseline = false;
+
 SEXP Compiler::finalize() {
     // Rprintf("****************************************************\n");
     // Rprintf("Compiling function\n");
@@ -1206,6 +1263,14 @@ SEXP Compiler::finalize() {
     ctx.cs() << BC::ret();
     ctx.pop();
 
+    if (baseline) {
+#ifdef ENABLE_SLOWASSERT
+        CodeVerifier::verifyFunctionLayout(function.function->container(),
+                                           globalContext());
+#endif
+        return function.function->container();
+    }
+
     CodeEditor code(function.function->body(), formals);
 
     for (size_t i = 0; i < code.numPromises(); ++i)
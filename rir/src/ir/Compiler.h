@@ -5,6 +5,7 @@
 #include "R/Preserve.h"
 #include "R/Protect.h"
 #include "utils/FunctionWriter.h"
+#include "CompileCache.h"
 
 #include <unordered_map>
 #include <iostream>
@@ -24,6 +25,11 @@ class Compiler {
     Preserve preserve;
 
   public:
+    /** In baseline mode the bytecode is written straight through the
+     *  FunctionWriter, without the CodeEditor round-trip and the optimizer.
+     *  Closures get optimized later when the interpreter reoptimizes them.
+     */
+    static bool baseline;
 
     Compiler(SEXP exp) : exp(exp), formals(R_NilValue) {
         preserve(exp);
@@ -36,38 +42,29 @@ class Compiler {
 
     SEXP finalize();
 
-    static SEXP compileExpression(SEXP ast) {
-#if 0
-        size_t count = 1;
-        static std::unordered_map<SEXP, size_t> counts;
-        if (counts.count(ast)) {
-            counts.at(ast) = count = 1 + counts.at(ast);
-        } else {
-            counts[ast] = 1;
-        }
-        if (count % 200 == 0) {
-            std::cout << "<<<<<<< Warning: expression compiled "
-                      << count << "x:\n";
-            Rf_PrintValue(ast);
-            std::cout << "== Call:\n";
-            Rf_PrintValue(R_syscall(0, R_GlobalContext));
-            std::cout << "== Function:\n";
-            Rf_PrintValue(R_sysfunction(0, R_GlobalContext));
-            std::cout << ">>>>>>>\n";
-        }
-#endif
+    /** Returns the Function for ast and formals from the CompileCache, or
+     *  compiles and caches it.
+     */
+    static SEXP compile(SEXP ast, SEXP formals) {
+        SEXP cached = CompileCache::get(ast, formals);
+        if (cached)
+            return cached;
+        Compiler c(ast, formals);
+        Protect p;
+        SEXP res = p(c.finalize());
+        CompileCache::put(ast, formals, res);
+        return res;
+    }
 
-        // Rf_PrintValue(ast);
-        Compiler c(ast);
-        return c.finalize();
+    static SEXP compileExpression(SEXP ast) {
+        return compile(ast, R_NilValue);
     }
 
     static SEXP compileClosure(SEXP ast, SEXP formals) {
         Protect p;
         SEXP closure = p(allocSExp(CLOSXP));
 
-        Compiler c(ast, formals);
-        SEXP res = p(c.finalize());
+        SEXP res = p(compile(ast, formals));
 
         // Allocate a new vtable.
         DispatchTable* vtable = DispatchTable::create(1);
@@ -1,17 +1,136 @@
 #include "ir/Optimizer.h"
+#include "analysis/types.h"
+#include "optimization/bounds_check.h"
 #include "optimization/cleanup.h"
+#include "optimization/constant_fold.h"
+#include "optimization/dead_store.h"
+#include "optimization/escape.h"
+#include "optimization/in_place.h"
+#include "optimization/inline.h"
+#include "optimization/licm.h"
 #include "optimization/localize.h"
-#include "optimization/stupid_inline.h"
+#include "optimization/release_dead.h"
+#include "optimization/type_specialize.h"
+#include "optimization/value_numbering.h"
 
 namespace rir {
 
+namespace {
+
+/** Whether bc computes on its operands by calling into R, which dispatches
+ * on objects.
+ */
+bool dispatchesOnOperands(BC bc) {
+    switch (bc.bc) {
+    case Opcode::add_:
+    case Opcode::sub_:
+    case Opcode::mul_:
+    case Opcode::div_:
+    case Opcode::pow_:
+    case Opcode::idiv_:
+    case Opcode::mod_:
+    case Opcode::uplus_:
+    case Opcode::uminus_:
+    case Opcode::not_:
+    case Opcode::asbool_:
+    case Opcode::aslogical_:
+        return true;
+    default:
+        return bc.isRelop() || bc.isRelopJmp();
+    }
+}
+
+/** Checks whether code may observe or jump to the context of its
+ * activation. That is the case for return_, loop contexts, every call
+ * except to builtins known not to run arbitrary code, operations which
+ * might dispatch, since the type analysis cannot show their operands to be
+ * plain, and loads which might force a promise.
+ */
+bool usesContext(CodeEditor& code, bool& canDeopt) {
+    auto& types = code.analyses().get<TypeAnalysis>();
+    for (auto i = code.begin(); i != code.end(); ++i) {
+        BC bc = *i;
+        if (bc.isCallsite()) {
+            CallSite* cs = i.callSite();
+            if (!cs->hasTarget)
+                return true;
+            SEXP target = Pool::get(*cs->target());
+            if (TYPEOF(target) != BUILTINSXP ||
+                !isSafeBuiltin(target->u.primsxp.offset))
+                return true;
+        } else if (bc.is(Opcode::return_) || bc.is(Opcode::beginloop_) ||
+                   bc.is(Opcode::lazy_) || bc.is(Opcode::run_lazy_)) {
+            // lazily compiled promises might contain a return
+            return true;
+        } else if (bc.is(Opcode::ldvar_)) {
+            // only a variable holding a plain value is surely no promise
+            if (!types[i][bc.immediateConst()].isPlain())
+                return true;
+        } else if (bc.is(Opcode::ldarg_) || bc.is(Opcode::ldvar2_) ||
+                   bc.is(Opcode::ldddvar_) || bc.is(Opcode::ldfun_) ||
+                   bc.is(Opcode::force_)) {
+            return true;
+        } else if (dispatchesOnOperands(bc)) {
+            auto& stack = types[i].stack();
+            for (size_t n = 0; n < bc.popCount(); ++n)
+                if (!stack[n].isPlain())
+                    return true;
+        } else if (bc.is(Opcode::guard_env_)) {
+            canDeopt = true;
+        }
+    }
+    for (size_t p = 0; p < code.numPromises(); ++p)
+        if (code.promise(p) && usesContext(*code.promise(p), canDeopt))
+            return true;
+    return false;
+}
+
+/** Checks whether a function needs its context. If it can deopt, its origin
+ * has to be context free as well, since we continue there.
+ */
+bool needsContext(CodeEditor& code, Function* origin) {
+    bool canDeopt = false;
+    if (usesContext(code, canDeopt))
+        return true;
+    if (!canDeopt)
+        return false;
+    if (!origin)
+        return true;
+    CodeEditor baseline(origin->container());
+    return needsContext(baseline, origin->origin()
+                                      ? Function::unpack(origin->origin())
+                                      : nullptr);
+}
+
+} // namespace
+
 bool Optimizer::optimize(CodeEditor& code, int steam) {
     bool changed = false;
     BCCleanup cleanup(code);
+    ConstantFolding folding(code);
+    DeadStoreElimination dse(code);
+    ValueNumbering vn(code);
+    LoopInvariantCodeMotion licm(code);
+    BoundsCheckElimination bce(code);
+    TypeSpecialization types(code);
     for (int i = 0; i < steam; ++i) {
         // puts("******");
         // code.print();
-        cleanup.run();
+        folding.run();
+        if (!code.changed)
+            cleanup.run();
+        // Stores are only removed once the cleanup is done, it works on the
+        // same instructions
+        if (!code.changed)
+            dse.run();
+        if (!code.changed)
+            vn.run();
+        if (!code.changed)
+            licm.run();
+        if (!code.changed)
+            bce.run();
+        if (!code.changed)
+            types.run();
         changed = changed || code.changed;
         if (!code.changed)
             break;
@@ -20,13 +139,13 @@ bool Optimizer::optimize(CodeEditor& code, int steam) {
     return changed;
 }
 
-bool Optimizer::inliner(CodeEditor& code, bool stable) {
+bool Optimizer::inliner(CodeEditor& code, bool stable, SEXP closureEnv) {
     Localizer local(code, stable);
     local.run();
     bool changed = code.changed;
     if (code.changed)
         code.commit();
-    StupidInliner inl(code);
+    Inliner inl(code, closureEnv);
     inl.run();
     changed = changed || code.changed;
     if (code.changed)
@@ -34,14 +153,14 @@ bool Optimizer::inliner(CodeEditor& code, bool stable) {
     return changed;
 }
 
-SEXP Optimizer::reoptimizeFunction(SEXP s) {
+SEXP Optimizer::reoptimizeFunction(SEXP s, SEXP closureEnv) {
     Function* fun = Function::unpack(s);
     bool safe = !fun->envLeaked && !fun->envChanged;
 
     CodeEditor code(s);
 
     for (int i = 0; i < 16; ++i) {
-        bool changedInl = Optimizer::inliner(code, safe);
+        bool changedInl = Optimizer::inliner(code, safe, closureEnv);
         bool changedOpt = Optimizer::optimize(code, 8);
         if (!changedInl && !changedOpt) {
             if (i == 0)
@@ -50,9 +169,25 @@ SEXP Optimizer::reoptimizeFunction(SEXP s) {
         }
     }
 
+    ReleaseDeadLocals release(code);
+    release.run();
+    if (code.changed)
+        code.commit();
+
+    InPlaceUpdate inPlace(code);
+    inPlace.run();
+    if (code.changed)
+        code.commit();
+
+    EscapeAnalysis escape(code);
+    escape.run();
+
+    bool contextFree = !needsContext(code, fun);
+
     Function* opt = code.finalize();
     opt->origin(fun);
     fun->next(opt);
+    opt->contextFree = contextFree;
 
 #ifdef ENABLE_SLOWASSERT
     CodeVerifier::verifyFunctionLayout(opt->container(), globalContext());
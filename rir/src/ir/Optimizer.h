@@ -8,8 +8,8 @@ namespace rir {
 class Optimizer {
   public:
     static bool optimize(CodeEditor&, int steam = 10);
-    static bool inliner(CodeEditor&, bool stableEnv);
-    static SEXP reoptimizeFunction(SEXP);
+    static bool inliner(CodeEditor&, bool stableEnv, SEXP closureEnv);
+    static SEXP reoptimizeFunction(SEXP, SEXP closureEnv);
 };
 }
 
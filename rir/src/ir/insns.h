@@ -67,6 +67,18 @@ DEF_INSTR(call_, 2, 1, 1, 0)
  */
 DEF_INSTR(promise_, 1, 0, 1, 1)
 
+/**
+ * lazy_:: body of a promise that is compiled on first use. Compiles the
+ * immediate AST, rewrites itself into run_lazy_ of the result and runs it.
+ */
+DEF_INSTR(lazy_, 1, 0, 1, 0)
+
+/**
+ * run_lazy_:: evaluate the immediate compiled expression in the current env
+ * and push the result
+ */
+DEF_INSTR(run_lazy_, 1, 0, 1, 0)
+
 /**
  * close_:: pop body and argument list, create closure, and push on object stack
  */
@@ -106,6 +118,12 @@ DEF_INSTR(stvar_, 1, 1, 0, 0)
  */
 DEF_INSTR(stvar2_, 1, 1, 0, 1)
 
+/**
+ * clear_:: drop the value of the immediate symbol's local binding, once it
+ *          is dead
+ */
+DEF_INSTR(clear_, 1, 0, 0, 0)
+
 /**
  * asbool_:: pop object stack, convert to Logical vector of size 1 and push on object stack. Throws an error if the result would be NA.
  */
@@ -121,6 +139,41 @@ DEF_INSTR(brtrue_, 1, 1, 0, 1)
  */
 DEF_INSTR(brfalse_, 1, 1, 0, 1)
 
+/**
+ * brfalse_lt_:: fused lt_, asbool_ and brfalse_. Pops rhs and lhs, branches to
+ * immediate offset if lhs < rhs is FALSE. Scalar ints and doubles are compared
+ * without allocating, everything else falls back to the builtin and asbool_
+ * semantics (ie. errors on NA and length zero).
+ */
+DEF_INSTR(brfalse_lt_, 1, 2, 0, 0)
+DEF_INSTR(brfalse_gt_, 1, 2, 0, 0)
+DEF_INSTR(brfalse_le_, 1, 2, 0, 0)
+DEF_INSTR(brfalse_ge_, 1, 2, 0, 0)
+DEF_INSTR(brfalse_eq_, 1, 2, 0, 0)
+DEF_INSTR(brfalse_ne_, 1, 2, 0, 0)
+
+/**
+ * brfalse_lt_int_:: brfalse_lt_, where both operands are known to be integer
+ * scalars without attributes. NA is still an error.
+ */
+DEF_INSTR(brfalse_lt_int_, 1, 2, 0, 0)
+DEF_INSTR(brfalse_gt_int_, 1, 2, 0, 0)
+DEF_INSTR(brfalse_le_int_, 1, 2, 0, 0)
+DEF_INSTR(brfalse_ge_int_, 1, 2, 0, 0)
+DEF_INSTR(brfalse_eq_int_, 1, 2, 0, 0)
+DEF_INSTR(brfalse_ne_int_, 1, 2, 0, 0)
+
+/**
+ * brfalse_lt_real_:: brfalse_lt_, where both operands are known to be double
+ * scalars without attributes. NA and NaN are still an error.
+ */
+DEF_INSTR(brfalse_lt_real_, 1, 2, 0, 0)
+DEF_INSTR(brfalse_gt_real_, 1, 2, 0, 0)
+DEF_INSTR(brfalse_le_real_, 1, 2, 0, 0)
+DEF_INSTR(brfalse_ge_real_, 1, 2, 0, 0)
+DEF_INSTR(brfalse_eq_real_, 1, 2, 0, 0)
+DEF_INSTR(brfalse_ne_real_, 1, 2, 0, 0)
+
 /**
  * br_:: branch to immediate offset
  */
@@ -160,6 +213,31 @@ DEF_INSTR(idiv_, 0, 2, 1, 0)
 DEF_INSTR(mod_, 0, 2, 1, 0)
 DEF_INSTR(sub_, 0, 2, 1, 0)
 
+/**
+ * add_real_:: add_, where both operands are known to be double scalars without
+ * attributes.
+ */
+DEF_INSTR(add_real_, 0, 2, 1, 1)
+DEF_INSTR(sub_real_, 0, 2, 1, 1)
+DEF_INSTR(mul_real_, 0, 2, 1, 1)
+DEF_INSTR(div_real_, 0, 2, 1, 1)
+
+/**
+ * add_int_:: add_, where both operands are known to be integer scalars without
+ * attributes. Still checks for NA and warns on overflow.
+ */
+DEF_INSTR(add_int_, 0, 2, 1, 0)
+DEF_INSTR(sub_int_, 0, 2, 1, 0)
+DEF_INSTR(mul_int_, 0, 2, 1, 0)
+
+/**
+ * add_int_unchecked_:: add_int_, where the operands are known not to be NA and
+ * the result to fit into an integer.
+ */
+DEF_INSTR(add_int_unchecked_, 0, 2, 1, 1)
+DEF_INSTR(sub_int_unchecked_, 0, 2, 1, 1)
+DEF_INSTR(mul_int_unchecked_, 0, 2, 1, 1)
+
 /**
  * uplus_:: unary plus
  */
@@ -203,6 +281,11 @@ DEF_INSTR(is_, 1, 1, 1, 1)
  */
 DEF_INSTR(extract1_, 0, 2, 1, 1)
 
+/**
+ * extract1_unchecked_:: extract1_, where b is known to be a valid index into a
+ */
+DEF_INSTR(extract1_unchecked_, 0, 2, 1, 1)
+
 /**
  * subset1_:: do a[b], where a and b are on the stack and a is no obj
  */
@@ -270,6 +353,13 @@ DEF_INSTR(set_shared_, 0, 1, 1, 1)
  */
 DEF_INSTR(make_unique_, 0, 1, 1, 1)
 
+/**
+ * reuse_:: the value below tos was loaded from a variable and the next
+ * instruction's result is stored back there. If that binding is its only
+ * reference, the next instruction may overwrite it with the result.
+ */
+DEF_INSTR(reuse_, 0, 0, 0, 1)
+
 /**
  * lgl_or_:: computes the logical (ternary) or of the two tos vals
  */
@@ -307,6 +397,13 @@ DEF_INSTR(inc_, 0, 1, 1, 1)
  */
 DEF_INSTR(test_bounds_, 0, 2, 3, 1)
 
+/**
+ * for_step_ :: inc_, test_bounds_ and brfalse_ in one: increments the index at
+ * stack[0] and branches to the immediate offset if it is out of the bounds of
+ * the vector at stack[1]. Not pure, it is a jump and allocates the new index.
+ */
+DEF_INSTR(for_step_, 1, 2, 2, 0)
+
 /**
  * return_ :: return instruction. Non-local return instruction as opposed to ret_.
  */
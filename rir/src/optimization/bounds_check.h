@@ -0,0 +1,316 @@
+#ifndef RIR_OPTIMIZER_BOUNDS_CHECK_H
+#define RIR_OPTIMIZER_BOUNDS_CHECK_H
+
+#include "analysis/dataflow.h"
+#include "analysis/loops.h"
+#include "analysis/types.h"
+#include "analysis_framework/manager.h"
+
+#include <climits>
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+
+namespace rir {
+
+/** Replaces extract1_ by extract1_unchecked_ where the index is known to be
+ * a whole number within the bounds of the vector.
+ *
+ * The for loop fetches the element right after for_step_ checked the counter.
+ *
+ * Besides that, in a loop which does not store to the vector x, the variable
+ * i ranges over 1 .. length(x) if
+ *   - it is the variable of a for loop over seq_along(x) or
+ *     seq_len(length(x)), or
+ *   - the loop header leaves the loop unless i <= length(x) (or i <
+ *     length(x)), i holds a whole number >= 1 when the loop is entered and
+ *     the loop only ever adds whole numbers >= 0 to it.
+ * This holds from where the loop establishes it up to the next store to i.
+ * The compiler emits structured code, the only way back into that range
+ * without passing the header are inner loops, accesses x[[i]] in there are
+ * left alone. Other code must not change i or x behind our back, thus the
+ * environment must not have leaked when the loop header is reached, neither
+ * from before the loop nor from the end of its body (according to the type
+ * analysis).
+ *
+ * 1:length(x) does not qualify, for an empty x it is c(1, 0).
+ */
+class BoundsCheckElimination {
+  public:
+    CodeEditor& code_;
+
+    BoundsCheckElimination(CodeEditor& code) : code_(code) {}
+
+  private:
+    typedef LoopAnalysis::Loop Loop;
+
+    const std::vector<CodeEditor::Iterator>* ins_ = nullptr;
+    std::unordered_map<LabelT, size_t> labels_;
+    DataflowAnalysis<Type::Conservative>* dataflow_ = nullptr;
+    TypeAnalysis* types_ = nullptr;
+    std::vector<bool> done_;
+
+    BC at(size_t pos) { return *(*ins_)[pos]; }
+
+    /** Moves pos to the instruction pushing the value consumed last by the
+     * one at pos, if that is in the same basic block.
+     */
+    bool prev(size_t& pos) {
+        do {
+            if (pos == 0)
+                return false;
+            --pos;
+        } while (at(pos).is(Opcode::guard_fun_));
+        return !at(pos).isLabel() && !at(pos).isJmp();
+    }
+
+    static SEXP loaded(BC bc) {
+        if (bc.is(Opcode::ldvar_) || bc.is(Opcode::ldlval_))
+            return bc.immediateConst();
+        return nullptr;
+    }
+
+    bool callsBuiltin(size_t pos, const char* name) {
+        BC bc = at(pos);
+        if (!bc.is(Opcode::static_call_stack_) ||
+            bc.immediate.call_args.nargs != 1)
+            return false;
+        CallSite* cs = (*ins_)[pos].callSite();
+        return !cs->hasNames &&
+               Pool::get(*cs->target()) == Rf_install(name)->u.symsxp.value;
+    }
+
+    /** If the instruction at pos computes length(x), returns x and moves pos
+     * to its load.
+     */
+    SEXP lengthOf(size_t& pos) {
+        if (!at(pos).is(Opcode::length_) && !callsBuiltin(pos, "length"))
+            return nullptr;
+        return prev(pos) ? loaded(at(pos)) : nullptr;
+    }
+
+    static bool wholeNumber(SEXP c, double min) {
+        if ((TYPEOF(c) != INTSXP && TYPEOF(c) != REALSXP) || XLENGTH(c) != 1 ||
+            ATTRIB(c) != R_NilValue)
+            return false;
+        if (TYPEOF(c) == INTSXP)
+            return INTEGER(c)[0] != NA_INTEGER && INTEGER(c)[0] >= min;
+        double v = REAL(c)[0];
+        return R_FINITE(v) && v == std::floor(v) && v >= min && v <= INT_MAX;
+    }
+
+    bool isStore(size_t pos, SEXP sym) {
+        BC bc = at(pos);
+        return (bc.is(Opcode::stvar_) || bc.is(Opcode::stvar2_) ||
+                bc.is(Opcode::clear_)) &&
+               bc.immediateConst() == sym;
+    }
+
+    /** Whether the store at pos is i <- i + k for a whole number k >= 0.
+     */
+    bool isIncrement(size_t pos, SEXP i) {
+        if (!at(pos).is(Opcode::stvar_))
+            return false;
+        do {
+            if (pos == 0)
+                return false;
+            --pos;
+        } while (at(pos).is(Opcode::dup_) || at(pos).is(Opcode::set_shared_));
+        if ((!at(pos).is(Opcode::add_) && !at(pos).is(Opcode::add_int_) &&
+             !at(pos).is(Opcode::add_int_unchecked_) &&
+             !at(pos).is(Opcode::add_real_)) ||
+            pos < 2)
+            return false;
+        BC a = at(pos - 2);
+        BC b = at(pos - 1);
+        if (loaded(a) != i)
+            std::swap(a, b);
+        return loaded(a) == i && b.is(Opcode::push_) &&
+               wholeNumber(b.immediateConst(), 0);
+    }
+
+    /** for (i in seq_along(x)) or for (i in seq_len(length(x))), the range
+     * starts after the store to i.
+     */
+    bool forLoop(const Loop& loop, SEXP& i, SEXP& x, size_t& from) {
+        size_t pos = loop.begin + 1;
+        if (pos + 3 > loop.end)
+            return false;
+        if (at(pos).is(Opcode::put_))
+            ++pos;
+        if (!at(pos).is(Opcode::for_step_) || !at(pos + 1).is(Opcode::dup2_))
+            return false;
+        pos += 2;
+        if (!at(pos).is(Opcode::extract1_) &&
+            !at(pos).is(Opcode::extract1_unchecked_))
+            return false;
+        ++pos;
+        while (pos < loop.end &&
+               (at(pos).is(Opcode::pick_) || at(pos).is(Opcode::swap_)))
+            ++pos;
+        if (!at(pos).is(Opcode::stvar_))
+            return false;
+        i = at(pos).immediateConst();
+        from = pos + 1;
+
+        // the sequence, then set_shared_ and the counter
+        size_t seq = loop.begin;
+        if (seq > 0 && at(seq - 1).is(Opcode::beginloop_))
+            --seq;
+        if (seq < 3 || !at(seq - 1).is(Opcode::push_) ||
+            !at(seq - 2).is(Opcode::set_shared_))
+            return false;
+        seq -= 3;
+
+        if (callsBuiltin(seq, "seq_along")) {
+            x = prev(seq) ? loaded(at(seq)) : nullptr;
+        } else if (callsBuiltin(seq, "seq_len")) {
+            x = prev(seq) ? lengthOf(seq) : nullptr;
+        } else {
+            return false;
+        }
+        return x != nullptr;
+    }
+
+    /** while (i <= length(x)), the range starts after the test.
+     */
+    bool whileLoop(const Loop& loop, SEXP& i, SEXP& x, size_t& from) {
+        if (loop.preheader == code_.end())
+            return false;
+
+        size_t test = loop.begin + 1;
+        while (test < loop.end && !at(test).isJmp() && !at(test).isLabel() &&
+               !at(test).isReturn())
+            ++test;
+        BC bc = at(test);
+        bool indexLeft = bc.is(Opcode::brfalse_le_) ||
+                         bc.is(Opcode::brfalse_lt_) ||
+                         bc.is(Opcode::brfalse_le_int_) ||
+                         bc.is(Opcode::brfalse_lt_int_) ||
+                         bc.is(Opcode::brfalse_le_real_) ||
+                         bc.is(Opcode::brfalse_lt_real_);
+        bool indexRight = bc.is(Opcode::brfalse_ge_) ||
+                          bc.is(Opcode::brfalse_gt_) ||
+                          bc.is(Opcode::brfalse_ge_int_) ||
+                          bc.is(Opcode::brfalse_gt_int_) ||
+                          bc.is(Opcode::brfalse_ge_real_) ||
+                          bc.is(Opcode::brfalse_gt_real_);
+        if ((!indexLeft && !indexRight) ||
+            labels_.at(bc.immediate.offset) <= loop.end)
+            return false;
+
+        size_t pos = test;
+        if (!prev(pos))
+            return false;
+        if (indexLeft) {
+            x = lengthOf(pos);
+            if (!x || !prev(pos))
+                return false;
+            i = loaded(at(pos));
+        } else {
+            i = loaded(at(pos));
+            if (!i || !prev(pos))
+                return false;
+            x = lengthOf(pos);
+        }
+        if (!i || !x)
+            return false;
+
+        for (size_t p = loop.begin; p <= loop.end; ++p)
+            if (isStore(p, i) && !isIncrement(p, i))
+                return false;
+
+        // copy first, constant() moves the analysis to other instructions
+        auto preheader = loop.preheader;
+        FValue entry = (*dataflow_)[preheader][i];
+        if (entry.t != FValue::Type::Constant ||
+            !wholeNumber(dataflow_->constant(entry), 1))
+            return false;
+
+        from = test + 1;
+        return true;
+    }
+
+    /** Whether no foreign code can see the environment while the loop runs.
+     */
+    bool runsPrivately(const Loop& loop) {
+        if (loop.begin + 1 > loop.end)
+            return false;
+        return !(*types_)[(*ins_)[loop.begin + 1]].global().leaksEnvironment;
+    }
+
+    /** Whether some jump other than to the loop header leads from behind pos
+     * back to it.
+     */
+    bool reentered(const Loop& loop, size_t pos) {
+        for (size_t j = pos + 1; j <= loop.end; ++j) {
+            BC bc = at(j);
+            if (!bc.isJmp())
+                continue;
+            size_t target = labels_.at(bc.immediate.offset);
+            if (target <= pos && target != loop.begin)
+                return true;
+        }
+        return false;
+    }
+
+    void uncheck(const Loop& loop, SEXP i, SEXP x, size_t from) {
+        for (size_t pos = loop.begin; pos <= loop.end; ++pos)
+            if (isStore(pos, x))
+                return;
+
+        for (size_t pos = from; pos <= loop.end && !isStore(pos, i); ++pos) {
+            // x[[i]] is ldvar x, brobj_, ldvar i, extract1_
+            if (!at(pos).is(Opcode::extract1_) || done_[pos] || pos < 3 ||
+                loaded(at(pos - 1)) != i || !at(pos - 2).is(Opcode::brobj_) ||
+                loaded(at(pos - 3)) != x || reentered(loop, pos))
+                continue;
+            replace(pos);
+        }
+    }
+
+    void replace(size_t pos) {
+        auto cur = (*ins_)[pos].asCursor(code_);
+        cur.remove();
+        cur << BC::extract1Unchecked();
+        done_[pos] = true;
+    }
+
+  public:
+    void run() {
+        if (code_.begin() == code_.end())
+            return;
+
+        auto& loops = code_.analyses().get<LoopAnalysis>();
+        ins_ = &loops.instructions;
+        done_.assign(ins_->size(), false);
+
+        labels_.clear();
+        for (size_t pos = 0; pos < ins_->size(); ++pos)
+            if (at(pos).isLabel())
+                labels_[at(pos).immediate.offset] = pos;
+
+        // Analyses are computed before anything changes
+        dataflow_ =
+            &code_.analyses().get<DataflowAnalysis<Type::Conservative>>();
+        types_ = &code_.analyses().get<TypeAnalysis>();
+
+        // The element the for loop fetches
+        for (size_t pos = 2; pos < ins_->size(); ++pos)
+            if (at(pos).is(Opcode::extract1_) &&
+                at(pos - 1).is(Opcode::dup2_) &&
+                at(pos - 2).is(Opcode::for_step_))
+                replace(pos);
+
+        for (auto& loop : loops.loops) {
+            SEXP i, x;
+            size_t from;
+            if (!runsPrivately(loop))
+                continue;
+            if (forLoop(loop, i, x, from) || whileLoop(loop, i, x, from))
+                uncheck(loop, i, x, from);
+        }
+    }
+};
+}
+#endif
@@ -2,17 +2,21 @@
 #define RIR_OPTIMIZER_CLEANUP_H
 
 #include "analysis/dataflow.h"
+#include "analysis_framework/manager.h"
 
 namespace rir {
 
 class BCCleanup : public InstructionDispatcher::Receiver {
   public:
-    DataflowAnalysis<Type::Conservative> analysis;
+    DataflowAnalysis<Type::Conservative>& analysis;
     InstructionDispatcher dispatcher;
     CodeEditor& code_;
     bool leaksEnvironment;
 
-    BCCleanup(CodeEditor& code) : dispatcher(*this), code_(code) {}
+    BCCleanup(CodeEditor& code)
+        : analysis(
+              code.analyses().get<DataflowAnalysis<Type::Conservative>>()),
+          dispatcher(*this), code_(code) {}
 
     void nop_(CodeEditor::Iterator ins) override {
         CodeEditor::Cursor cur = ins.asCursor(code_);
@@ -20,6 +24,11 @@ class BCCleanup : public InstructionDispatcher::Receiver {
         return;
     }
 
+    void reuse_(CodeEditor::Iterator ins) override {
+        // InPlaceUpdate runs last, the code in between might change
+        ins.asCursor(code_).remove();
+    }
+
     void pop_(CodeEditor::Iterator ins) override {
         auto v = analysis[ins].top();
         if (!v.singleDef())
@@ -30,7 +39,7 @@ class BCCleanup : public InstructionDispatcher::Receiver {
 
         bool isDup = def.is(Opcode::dup_);
         // push - pop elimination
-        if (def.is(Opcode::push_) || isDup) {
+        if (def.is(Opcode::push_) || def.is(Opcode::pull_) || isDup) {
             bool used = v.used();
             if (used && v.singleUse()) {
                 CodeEditor::Iterator use = v.use();
@@ -98,64 +107,24 @@ class BCCleanup : public InstructionDispatcher::Receiver {
         }
     }
 
-    void add_(CodeEditor::Iterator ins) override {
-        auto b = analysis[ins].stack()[0];
-        auto a = analysis[ins].stack()[1];
-        if (a.t == FValue::Type::Constant && b.t == FValue::Type::Constant) {
-            SEXP ca = analysis.constant(a);
-            SEXP cb = analysis.constant(b);
-            if (!isObject(ca) && !isObject(cb)) {
-                Protect p;
-                SEXP plus = Rf_install("+");
-                SEXP c = LCONS(plus->u.symsxp.value,
-                               LCONS(ca, LCONS(cb, R_NilValue)));
-                p(c);
-                SEXP res = Rf_eval(c, R_BaseEnv);
-                auto cur = ins.asCursor(code_);
-                cur.remove();
-                cur << BC::pop() << BC::pop() << BC::push(res);
-            }
-        }
-    }
-
-    void sub_(CodeEditor::Iterator ins) override {
-        auto b = analysis[ins].stack()[0];
-        auto a = analysis[ins].stack()[1];
-        if (a.t == FValue::Type::Constant && b.t == FValue::Type::Constant) {
-            SEXP ca = analysis.constant(a);
-            SEXP cb = analysis.constant(b);
-            if (!isObject(ca) && !isObject(cb)) {
-                Protect p;
-                SEXP plus = Rf_install("-");
-                SEXP c = LCONS(plus->u.symsxp.value,
-                               LCONS(ca, LCONS(cb, R_NilValue)));
-                p(c);
-                SEXP res = Rf_eval(c, R_BaseEnv);
-                auto cur = ins.asCursor(code_);
-                cur.remove();
-                cur << BC::pop() << BC::pop() << BC::push(res);
-            }
-        }
-    }
+    void asbool_(CodeEditor::Iterator ins) override {
+        // relop; asbool; brfalse -> fused compare and branch
+        if (ins == code_.begin() || (ins + 1) == code_.end())
+            return;
+        auto prev = ins - 1;
+        auto next = ins + 1;
+        if (prev.deleted() || next.deleted() || !(*prev).isRelop() ||
+            !(*next).is(Opcode::brfalse_))
+            return;
 
-    void mul_(CodeEditor::Iterator ins) override {
-        auto b = analysis[ins].stack()[0];
-        auto a = analysis[ins].stack()[1];
-        if (a.t == FValue::Type::Constant && b.t == FValue::Type::Constant) {
-            SEXP ca = analysis.constant(a);
-            SEXP cb = analysis.constant(b);
-            if (!isObject(ca) && !isObject(cb)) {
-                Protect p;
-                SEXP plus = Rf_install("*");
-                SEXP c = LCONS(plus->u.symsxp.value,
-                               LCONS(ca, LCONS(cb, R_NilValue)));
-                p(c);
-                SEXP res = Rf_eval(c, R_BaseEnv);
-                auto cur = ins.asCursor(code_);
-                cur.remove();
-                cur << BC::pop() << BC::pop() << BC::push(res);
-            }
-        }
+        auto cur = prev.asCursor(code_);
+        unsigned src = cur.srcIdx();
+        cur.remove();
+        cur.remove();
+        cur.remove();
+        cur << BC::brfalseRelop((*prev).bc, (*next).immediate.offset);
+        if (src)
+            cur.addSrcIdx(src);
     }
 
     void invisible_(CodeEditor::Iterator ins) override {
@@ -238,7 +207,7 @@ class BCCleanup : public InstructionDispatcher::Receiver {
     // }
 
     void run() {
-        analysis.analyze(code_);
+        code_.analyses().get<DataflowAnalysis<Type::Conservative>>();
         for (auto i = code_.begin(); i != code_.end(); ++i)
             dispatcher.dispatch(i);
     }
@@ -0,0 +1,392 @@
+#ifndef RIR_OPTIMIZER_CONSTANT_FOLD_H
+#define RIR_OPTIMIZER_CONSTANT_FOLD_H
+
+#include "R/Protect.h"
+#include "analysis/dataflow.h"
+#include "analysis_framework/manager.h"
+
+#include <unordered_map>
+#include <vector>
+
+namespace rir {
+
+/** Evaluates instructions whose arguments are known constants.
+ *
+ * Arithmetic, relational, logical and unary instructions, as well as calls to
+ * the builtins isSafeBuiltin lists, are replaced by their result if all
+ * arguments are constant vectors which are not objects. The result is
+ * computed by calling the primitive in the base environment at compile time.
+ * If that signals an error or a warning, the instruction stays, the condition
+ * has to be raised at runtime. So does it if the result is a long vector,
+ * constants stay in the pool forever.
+ *
+ * Branches on constant conditions become unconditional and code no longer
+ * reachable from the entry is removed.
+ */
+class ConstantFolding {
+  public:
+    CodeEditor& code_;
+
+    ConstantFolding(CodeEditor& code) : code_(code) {}
+
+    static constexpr R_xlen_t MAX_FOLDED_LENGTH = 16;
+
+  private:
+    DataflowAnalysis<Type::Conservative>* analysis_ = nullptr;
+
+    /** Fills args with the n topmost stack values before ins, the deepest
+     * first, if they are all constants we can compute with.
+     */
+    bool constantArgs(CodeEditor::Iterator ins, size_t n,
+                      std::vector<SEXP>& args) {
+        // copy first, constant() moves the analysis to other instructions
+        std::vector<FValue> values;
+        for (size_t i = 0; i < n; ++i)
+            values.push_back((*analysis_)[ins].stack()[i]);
+
+        args.resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            if (values[i].t != FValue::Type::Constant)
+                return false;
+            SEXP c = analysis_->constant(values[i]);
+            if ((!isVectorAtomic(c) && c != R_NilValue) || isObject(c))
+                return false;
+            args[n - 1 - i] = c;
+        }
+        return true;
+    }
+
+    /** Applies fun to args in the base environment, returns nullptr if that
+     * signals an error or a warning.
+     */
+    static SEXP apply(SEXP fun, const std::vector<SEXP>& args) {
+        static SEXP tryCatch = Rf_install("tryCatch");
+        static SEXP identity = Rf_install("identity");
+        static SEXP warning = Rf_install("warning");
+
+        Protect p;
+        SEXP call = R_NilValue;
+        for (auto a = args.rbegin(); a != args.rend(); ++a)
+            call = p(LCONS(*a, call));
+        call = p(LCONS(fun, call));
+
+        // tryCatch(call, warning = identity)
+        SEXP handler = p(LCONS(identity, R_NilValue));
+        SET_TAG(handler, warning);
+        SEXP guarded = p(LCONS(tryCatch, LCONS(call, handler)));
+
+        int error = 0;
+        SEXP res = R_tryEvalSilent(guarded, R_BaseEnv, &error);
+        if (error || Rf_inherits(res, "condition") ||
+            (Rf_isVector(res) && XLENGTH(res) > MAX_FOLDED_LENGTH))
+            return nullptr;
+        return res;
+    }
+
+    static SEXP primitive(const char* name) {
+        return Rf_install(name)->u.symsxp.value;
+    }
+
+    static const char* primitiveName(Opcode op) {
+        switch (op) {
+        case Opcode::add_:
+        case Opcode::add_int_:
+        case Opcode::add_int_unchecked_:
+        case Opcode::add_real_:
+        case Opcode::uplus_:
+            return "+";
+        case Opcode::sub_:
+        case Opcode::sub_int_:
+        case Opcode::sub_int_unchecked_:
+        case Opcode::sub_real_:
+        case Opcode::uminus_:
+            return "-";
+        case Opcode::mul_:
+        case Opcode::mul_int_:
+        case Opcode::mul_int_unchecked_:
+        case Opcode::mul_real_:
+            return "*";
+        case Opcode::div_:
+        case Opcode::div_real_:
+            return "/";
+        case Opcode::idiv_:
+            return "%/%";
+        case Opcode::mod_:
+            return "%%";
+        case Opcode::pow_:
+            return "^";
+        case Opcode::lt_:
+        case Opcode::brfalse_lt_:
+        case Opcode::brfalse_lt_int_:
+        case Opcode::brfalse_lt_real_:
+            return "<";
+        case Opcode::gt_:
+        case Opcode::brfalse_gt_:
+        case Opcode::brfalse_gt_int_:
+        case Opcode::brfalse_gt_real_:
+            return ">";
+        case Opcode::le_:
+        case Opcode::brfalse_le_:
+        case Opcode::brfalse_le_int_:
+        case Opcode::brfalse_le_real_:
+            return "<=";
+        case Opcode::ge_:
+        case Opcode::brfalse_ge_:
+        case Opcode::brfalse_ge_int_:
+        case Opcode::brfalse_ge_real_:
+            return ">=";
+        case Opcode::eq_:
+        case Opcode::brfalse_eq_:
+        case Opcode::brfalse_eq_int_:
+        case Opcode::brfalse_eq_real_:
+            return "==";
+        case Opcode::ne_:
+        case Opcode::brfalse_ne_:
+        case Opcode::brfalse_ne_int_:
+        case Opcode::brfalse_ne_real_:
+            return "!=";
+        case Opcode::not_:
+            return "!";
+        default:
+            return nullptr;
+        }
+    }
+
+    /** The value of a condition, as asbool_ would compute it, or NA_LOGICAL
+     * if that would not succeed.
+     */
+    static int condition(SEXP c) {
+        if (XLENGTH(c) != 1 || ATTRIB(c) != R_NilValue)
+            return NA_LOGICAL;
+        switch (TYPEOF(c)) {
+        case LGLSXP:
+            return LOGICAL(c)[0];
+        case INTSXP:
+            return INTEGER(c)[0] == NA_INTEGER ? NA_LOGICAL
+                                               : INTEGER(c)[0] != 0;
+        case REALSXP:
+            return ISNAN(REAL(c)[0]) ? NA_LOGICAL : REAL(c)[0] != 0;
+        default:
+            return NA_LOGICAL;
+        }
+    }
+
+    void replace(CodeEditor::Iterator ins, size_t pops, SEXP res) {
+        // the branches compare with the logical singletons
+        if (TYPEOF(res) == LGLSXP && XLENGTH(res) == 1 &&
+            ATTRIB(res) == R_NilValue)
+            res = LOGICAL(res)[0] == NA_LOGICAL
+                      ? R_LogicalNAValue
+                      : LOGICAL(res)[0] ? R_TrueValue : R_FalseValue;
+        auto cur = ins.asCursor(code_);
+        cur.remove();
+        for (size_t i = 0; i < pops; ++i)
+            cur << BC::pop();
+        cur << BC::push(res);
+    }
+
+    /** Replaces a conditional jump consuming pops values by its outcome.
+     */
+    void decide(CodeEditor::Iterator ins, size_t pops, bool taken) {
+        BC bc = *ins;
+        auto cur = ins.asCursor(code_);
+        cur.remove();
+        for (size_t i = 0; i < pops; ++i)
+            cur << BC::pop();
+        if (taken)
+            cur << BC::br(bc.immediate.offset);
+    }
+
+    void fold(CodeEditor::Iterator ins) {
+        BC bc = *ins;
+        std::vector<SEXP> args;
+
+        switch (bc.bc) {
+        case Opcode::add_:
+        case Opcode::sub_:
+        case Opcode::mul_:
+        case Opcode::div_:
+        case Opcode::idiv_:
+        case Opcode::mod_:
+        case Opcode::pow_:
+        case Opcode::add_int_:
+        case Opcode::sub_int_:
+        case Opcode::mul_int_:
+        case Opcode::add_int_unchecked_:
+        case Opcode::sub_int_unchecked_:
+        case Opcode::mul_int_unchecked_:
+        case Opcode::add_real_:
+        case Opcode::sub_real_:
+        case Opcode::mul_real_:
+        case Opcode::div_real_:
+        case Opcode::lt_:
+        case Opcode::gt_:
+        case Opcode::le_:
+        case Opcode::ge_:
+        case Opcode::eq_:
+        case Opcode::ne_:
+        case Opcode::uplus_:
+        case Opcode::uminus_:
+        case Opcode::not_: {
+            size_t n = bc.popCount();
+            if (!constantArgs(ins, n, args))
+                return;
+            SEXP res = apply(primitive(primitiveName(bc.bc)), args);
+            if (res)
+                replace(ins, n, res);
+            return;
+        }
+
+        case Opcode::lgl_and_:
+        case Opcode::lgl_or_: {
+            if (!constantArgs(ins, 2, args) || TYPEOF(args[0]) != LGLSXP ||
+                TYPEOF(args[1]) != LGLSXP)
+                return;
+            int a = LOGICAL(args[0])[0];
+            int b = LOGICAL(args[1])[0];
+            int res;
+            if (bc.is(Opcode::lgl_and_))
+                res = (a == 0 || b == 0) ? 0 : (a == 1 && b == 1) ? 1
+                                                                 : NA_LOGICAL;
+            else
+                res = (a == 1 || b == 1) ? 1 : (a == 0 && b == 0) ? 0
+                                                                 : NA_LOGICAL;
+            replace(ins, 2, Rf_ScalarLogical(res));
+            return;
+        }
+
+        case Opcode::aslogical_:
+            if (constantArgs(ins, 1, args))
+                replace(ins, 1, Rf_ScalarLogical(Rf_asLogical(args[0])));
+            return;
+
+        case Opcode::asbool_: {
+            if (!constantArgs(ins, 1, args))
+                return;
+            int c = condition(args[0]);
+            if (c != NA_LOGICAL)
+                replace(ins, 1, c ? R_TrueValue : R_FalseValue);
+            return;
+        }
+
+        // like the interpreter, compare with the logical singletons
+        case Opcode::brtrue_:
+            if (constantArgs(ins, 1, args))
+                decide(ins, 1, args[0] == R_TrueValue);
+            return;
+
+        case Opcode::brfalse_:
+            if (constantArgs(ins, 1, args))
+                decide(ins, 1, args[0] == R_FalseValue);
+            return;
+
+        case Opcode::brfalse_lt_:
+        case Opcode::brfalse_gt_:
+        case Opcode::brfalse_le_:
+        case Opcode::brfalse_ge_:
+        case Opcode::brfalse_eq_:
+        case Opcode::brfalse_ne_:
+        case Opcode::brfalse_lt_int_:
+        case Opcode::brfalse_gt_int_:
+        case Opcode::brfalse_le_int_:
+        case Opcode::brfalse_ge_int_:
+        case Opcode::brfalse_eq_int_:
+        case Opcode::brfalse_ne_int_:
+        case Opcode::brfalse_lt_real_:
+        case Opcode::brfalse_gt_real_:
+        case Opcode::brfalse_le_real_:
+        case Opcode::brfalse_ge_real_:
+        case Opcode::brfalse_eq_real_:
+        case Opcode::brfalse_ne_real_: {
+            if (!constantArgs(ins, 2, args))
+                return;
+            SEXP res = apply(primitive(primitiveName(bc.bc)), args);
+            if (!res)
+                return;
+            int c = condition(res);
+            if (c != NA_LOGICAL)
+                decide(ins, 2, !c);
+            return;
+        }
+
+        case Opcode::call_stack_:
+        case Opcode::static_call_stack_: {
+            CallSite* cs = ins.callSite();
+            size_t nargs = bc.immediate.call_args.nargs;
+            if (cs->hasNames)
+                return;
+
+            SEXP fun;
+            if (bc.is(Opcode::static_call_stack_)) {
+                fun = Pool::get(*cs->target());
+            } else {
+                auto f = (*analysis_)[ins].stack()[nargs];
+                if (f.t != FValue::Type::Constant)
+                    return;
+                fun = analysis_->constant(f);
+            }
+            if (TYPEOF(fun) != BUILTINSXP ||
+                !isSafeBuiltin(fun->u.primsxp.offset))
+                return;
+
+            if (!constantArgs(ins, nargs, args))
+                return;
+            SEXP res = apply(fun, args);
+            if (res)
+                replace(ins, bc.popCount(), res);
+            return;
+        }
+
+        default:
+            return;
+        }
+    }
+
+    /** Removes all instructions which cannot be reached from the entry.
+     */
+    void removeUnreachable() {
+        std::vector<CodeEditor::Iterator> instructions;
+        std::unordered_map<LabelT, size_t> labels;
+        for (auto i = code_.begin(); i != code_.end(); ++i) {
+            if ((*i).isLabel())
+                labels[(*i).immediate.offset] = instructions.size();
+            instructions.push_back(i);
+        }
+
+        std::vector<bool> reachable(instructions.size(), false);
+        std::vector<size_t> todo = {0};
+        while (!todo.empty()) {
+            size_t pos = todo.back();
+            todo.pop_back();
+            if (pos >= instructions.size() || reachable[pos])
+                continue;
+            reachable[pos] = true;
+            BC bc = *instructions[pos];
+            if (bc.isJmp())
+                todo.push_back(labels.at(bc.immediate.offset));
+            if (!bc.isUncondJmp() && !bc.isReturn())
+                todo.push_back(pos + 1);
+        }
+
+        for (size_t pos = 0; pos < instructions.size(); ++pos)
+            if (!reachable[pos])
+                instructions[pos].asCursor(code_).remove();
+    }
+
+  public:
+    void run() {
+        if (code_.begin() == code_.end())
+            return;
+
+        removeUnreachable();
+        if (code_.changed)
+            return;
+
+        analysis_ =
+            &code_.analyses().get<DataflowAnalysis<Type::Conservative>>();
+        for (auto i = code_.begin(); i != code_.end(); ++i)
+            fold(i);
+    }
+};
+}
+#endif
@@ -0,0 +1,93 @@
+#ifndef RIR_OPTIMIZER_DEAD_STORE_H
+#define RIR_OPTIMIZER_DEAD_STORE_H
+
+#include "analysis/liveness.h"
+#include "analysis/types.h"
+#include "analysis_framework/manager.h"
+
+namespace rir {
+
+/** Removes stores to local variables which are never read afterwards.
+ *
+ * This is only possible if nobody else can look at the environment: the
+ * function must not leak it (according to the type analysis, which knows
+ * that arithmetic on plain vectors does not dispatch), must not create
+ * promises or closures, which would read the variables behind the back of
+ * the liveness analysis, and must not deopt, since the baseline code might
+ * still read them.
+ *
+ * The stored value is popped instead. If it is computed by a pure
+ * instruction right before the store, that instruction goes too and only its
+ * arguments are popped, the cleanup pass takes it from there.
+ */
+class DeadStoreElimination {
+  public:
+    CodeEditor& code_;
+
+    DeadStoreElimination(CodeEditor& code) : code_(code) {}
+
+    /** Returns true if only the code itself can see the local environment.
+     */
+    static bool envIsPrivate(CodeEditor& code) {
+        auto& types = code.analyses().get<TypeAnalysis>();
+        if (!types.hasFinalState() ||
+            types.finalState().global().leaksEnvironment)
+            return false;
+
+        for (auto i = code.begin(); i != code.end(); ++i) {
+            switch ((*i).bc) {
+            case Opcode::promise_:
+            case Opcode::push_code_:
+            case Opcode::lazy_:
+            case Opcode::run_lazy_:
+            case Opcode::close_:
+            case Opcode::guard_env_:
+                return false;
+            default:
+                break;
+            }
+        }
+        return true;
+    }
+
+    void removeStore(CodeEditor::Iterator ins) {
+        // Note: ins is not a label, so prev always runs right before it
+        if (ins != code_.begin()) {
+            auto prev = ins - 1;
+            BC def = *prev;
+            if (!def.isLabel() && !def.isJmp() && def.isPure() &&
+                def.pushCount() == 1) {
+                CodeEditor::Cursor cur = prev.asCursor(code_);
+                cur.remove();
+                cur.remove();
+                for (size_t i = 0; i < def.popCount(); ++i)
+                    cur << BC::pop();
+                return;
+            }
+        }
+
+        CodeEditor::Cursor cur = ins.asCursor(code_);
+        cur.remove();
+        cur << BC::pop();
+    }
+
+    void run() {
+        if (code_.begin() == code_.end() || !envIsPrivate(code_))
+            return;
+
+        auto& liveness = code_.analyses().get<LivenessAnalysis>();
+
+        // Backwards, since that is the order liveness states are cheap to
+        // retrieve in
+        for (auto i = code_.rbegin(); i != code_.rend(); --i) {
+            if (!(*i).is(Opcode::stvar_) || (i + 1) == code_.end())
+                continue;
+            SEXP sym = (*i).immediateConst();
+            auto& live = liveness[i + 1].getState().variables;
+            if (live.find(sym) == live.end())
+                removeStore(i);
+        }
+    }
+};
+}
+#endif
@@ -0,0 +1,157 @@
+#ifndef RIR_OPTIMIZER_ESCAPE_H
+#define RIR_OPTIMIZER_ESCAPE_H
+
+#include "analysis/Signature.h"
+#include "analysis/dataflow.h"
+#include "analysis_framework/manager.h"
+#include "interpreter/interp_context.h"
+#include "interpreter/interp_data.h"
+#include "runtime/DispatchTable.h"
+
+namespace rir {
+
+/** Finds calls whose argument promises need not be allocated.
+ *
+ * A promise passed to a closure escapes if the callee can get at it other
+ * than by forcing it: by passing it on, through its environment (closures,
+ * promises, substitute and friends are all calls or close_) or by
+ * dispatching. The summary of a Function says its arguments do not escape if
+ * it is a leaf according to the SignatureAnalysis, consists of a single code
+ * object and calls nothing but safe builtins. It is stored in
+ * Function::argsLocal, the interpreter additionally checks the envLeaked bit
+ * the Function collects at runtime.
+ *
+ * If evaluating the arguments has no effects and cannot fail (constants and
+ * variables the dataflow analysis knows to hold values), evaluating them
+ * before the call is indistinguishable from evaluating them when forced. Such
+ * calls to a profiled target whose arguments do not escape get eagerArgs
+ * set, the interpreter then passes values instead of promises to any callee
+ * with that summary.
+ *
+ * The callee's environment itself is still allocated, the closure calling
+ * convention binds the arguments there.
+ */
+class EscapeAnalysis {
+  public:
+    CodeEditor& code_;
+
+    EscapeAnalysis(CodeEditor& code) : code_(code) {}
+
+    static bool safeTarget(CallSite* cs) {
+        if (!cs->hasTarget)
+            return false;
+        SEXP target = Pool::get(*cs->target());
+        return TYPEOF(target) == BUILTINSXP &&
+               isSafeBuiltin(target->u.primsxp.offset);
+    }
+
+    /** Computes the summary of f, if it is not known already.
+     */
+    static bool argumentsStayLocal(Function* f) {
+        if (f->argsLocal)
+            return true;
+
+        Code* c = f->body();
+        if (f->begin() != c)
+            return false;
+
+        Opcode* pc = c->code();
+        Opcode* end = pc + c->codeSize;
+        while (pc != end) {
+            BC bc = BC::advance(&pc);
+            if (bc.isCallsite()) {
+                if (!safeTarget(bc.callSite(c)))
+                    return false;
+                continue;
+            }
+            switch (bc.bc) {
+            case Opcode::close_:
+            case Opcode::lazy_:
+            case Opcode::run_lazy_:
+            // a <<- before forcing would change the value of the promise
+            case Opcode::stvar2_:
+                return false;
+            default:
+                break;
+            }
+        }
+
+        CodeEditor edit(f->container());
+        SignatureAnalysis signature;
+        signature.analyze(edit);
+        if (!signature.hasFinalState() || !signature.finalState().isLeaf())
+            return false;
+
+        f->argsLocal = true;
+        return true;
+    }
+
+    /** Whether evaluating the promise passed at the call now gives the same
+     * value, without effects, as evaluating it later.
+     */
+    static bool effectFree(CodeEditor& code, unsigned idx,
+                           CodeEditor::Iterator call,
+                           DataflowAnalysis<Type::Conservative>& dataflow) {
+        if (idx == MISSING_ARG_IDX || idx == DOTS_ARG_IDX)
+            return false;
+        CodeEditor* prom = code.promise(idx);
+        if (!prom)
+            return false;
+
+        auto i = prom->begin();
+        if (i == prom->end())
+            return false;
+        BC load = *i;
+        if (++i == prom->end() || !(*i).is(Opcode::ret_) ||
+            ++i != prom->end())
+            return false;
+
+        switch (load.bc) {
+        case Opcode::push_:
+            return true;
+        case Opcode::ldvar_:
+        case Opcode::ldlval_:
+            return dataflow[call][load.immediateConst()].isValue();
+        default:
+            return false;
+        }
+    }
+
+    void run() {
+        if (code_.begin() == code_.end())
+            return;
+
+        auto& dataflow =
+            code_.analyses().get<DataflowAnalysis<Type::Conservative>>();
+
+        for (auto i = code_.begin(); i != code_.end(); ++i) {
+            if (!(*i).is(Opcode::call_))
+                continue;
+
+            CallSite* cs = i.callSite();
+            if (cs->eagerArgs || cs->nargs == 0 || !cs->hasProfile)
+                continue;
+
+            CallSiteProfile* p = cs->profile();
+            if (p->taken < 50 || p->numTargets != 1)
+                continue;
+
+            SEXP t = p->targets[0];
+            if (TYPEOF(t) != CLOSXP || !isValidDispatchTableSEXP(BODY(t)))
+                continue;
+            if (!argumentsStayLocal(DispatchTable::unpack(BODY(t))->first()))
+                continue;
+
+            bool eager = true;
+            for (size_t a = 0; a < cs->nargs && eager; ++a)
+                eager = effectFree(code_, cs->args()[a], i, dataflow);
+
+            // Not a change of the code, the flag is copied along with the
+            // call site
+            if (eager)
+                cs->eagerArgs = true;
+        }
+    }
+};
+}
+#endif
@@ -0,0 +1,171 @@
+#ifndef RIR_OPTIMIZER_IN_PLACE_H
+#define RIR_OPTIMIZER_IN_PLACE_H
+
+#include "analysis/types.h"
+#include "analysis_framework/manager.h"
+
+#include <vector>
+
+namespace rir {
+
+/** Updates scalar accumulators like `s <- s + x` in place. The arithmetic
+ * normally allocates a fresh box for every result, since the lhs is still
+ * bound to s. For
+ *
+ *     ldvar_ s; <e>; op; stvar_ s
+ *
+ * the binding is about to be overwritten by the result anyway, so a reuse_
+ * in front of op lets it write into the old box, if s holds its only
+ * reference. That is checked at runtime with the NAMED count, which does
+ * not see values on the stack. Therefore the box loaded by the ldvar_ may
+ * not be copied by <e>, and no value below it may be the same box: they all
+ * need to be known to be of a different type. <e> can only be entered
+ * through the ldvar_ to be sure op consumes the box.
+ *
+ * This pass has to run last, the pattern breaks if anything is moved in
+ * between the load, the op and the store.
+ */
+class InPlaceUpdate {
+  public:
+    CodeEditor& code_;
+
+    InPlaceUpdate(CodeEditor& code) : code_(code) {}
+
+    static bool isArith(BC bc) {
+        switch (bc.bc) {
+        case Opcode::add_:
+        case Opcode::sub_:
+        case Opcode::mul_:
+        case Opcode::div_:
+        case Opcode::add_real_:
+        case Opcode::sub_real_:
+        case Opcode::mul_real_:
+        case Opcode::div_real_:
+        case Opcode::add_int_:
+        case Opcode::sub_int_:
+        case Opcode::mul_int_:
+        case Opcode::add_int_unchecked_:
+        case Opcode::sub_int_unchecked_:
+        case Opcode::mul_int_unchecked_:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    /** How many stack elements bc touches, counted from the top. */
+    static size_t reach(BC bc) {
+        if (bc.is(Opcode::pick_) || bc.is(Opcode::put_) ||
+            bc.is(Opcode::pull_))
+            return bc.immediate.i + 1;
+        return bc.popCount();
+    }
+
+    static bool isScalar(TValue v) {
+        return v.t == TValue::Type::Int || v.t == TValue::Type::Real;
+    }
+
+    void run() {
+        if (code_.begin() == code_.end())
+            return;
+
+        auto& types = code_.analyses().get<TypeAnalysis>();
+
+        std::vector<CodeEditor::Iterator> ins;
+        for (auto i = code_.begin(); i != code_.end(); ++i)
+            ins.push_back(i);
+
+        std::vector<CodeEditor::Iterator> reuse;
+        for (size_t b = 1; b + 1 < ins.size(); ++b) {
+            BC op = *ins[b];
+            BC st = *ins[b + 1];
+            if (!isArith(op) || !st.is(Opcode::stvar_))
+                continue;
+
+            size_t depth = types[ins[b]].stack().depth();
+            if (depth < 2)
+                continue;
+            TValue lhs = types[ins[b]].stack()[1];
+            if (!isScalar(lhs))
+                continue;
+
+            // the load of the lhs, it is the last one of the same variable
+            // at the right depth
+            size_t a = b;
+            while (a-- > 0) {
+                BC ld = *ins[a];
+                if (ld.is(Opcode::ldvar_) &&
+                    ld.immediate.pool == st.immediate.pool &&
+                    types[ins[a]].stack().depth() + 2 == depth)
+                    break;
+                if (ld.isReturn())
+                    break;
+            }
+            if (a == (size_t)-1 || !(*ins[a]).is(Opcode::ldvar_))
+                continue;
+
+            auto& before = types[ins[a]];
+            SEXP sym = Pool::get(st.immediate.pool);
+            if (before[sym].t != lhs.t)
+                continue;
+
+            if (candidate(ins, a, b, lhs, types))
+                reuse.push_back(ins[b]);
+        }
+
+        for (auto i : reuse) {
+            auto cur = i.asCursor(code_);
+            cur << BC::reuse();
+        }
+    }
+
+  private:
+    static bool jumps(BC bc) {
+        return bc.isJmp() || bc.is(Opcode::beginloop_) ||
+               bc.is(Opcode::for_step_);
+    }
+
+    bool candidate(std::vector<CodeEditor::Iterator> const& ins, size_t a,
+                   size_t b, TValue lhs, TypeAnalysis& types) {
+        size_t d = types[ins[a]].stack().depth();
+
+        // no other stack slot might be the same box
+        auto& below = types[ins[a]].stack();
+        for (size_t i = 0; i < d; ++i) {
+            TValue v = below[i];
+            if (v.t == lhs.t || v.t == TValue::Type::Any ||
+                v.t == TValue::Type::Plain || v.t == TValue::Type::Bottom)
+                return false;
+        }
+
+        // the loaded value stays in place and is not copied
+        for (size_t p = a + 1; p < b; ++p) {
+            BC bc = *ins[p];
+            if (bc.isReturn() || bc.is(Opcode::beginloop_) ||
+                bc.is(Opcode::for_step_))
+                return false;
+            if (bc.isLabel())
+                continue;
+            size_t depth = types[ins[p]].stack().depth();
+            if (depth < d + 1 + reach(bc))
+                return false;
+        }
+
+        // and <e> is only entered through the load
+        for (size_t p = a + 1; p < b; ++p) {
+            BC l = *ins[p];
+            if (!l.isLabel())
+                continue;
+            for (size_t j = 0; j < ins.size(); ++j) {
+                if (j > a && j < b)
+                    continue;
+                BC bc = *ins[j];
+                if (jumps(bc) && bc.immediate.offset == l.immediate.offset)
+                    return false;
+            }
+        }
+        return true;
+    }
+};
+}
+#endif
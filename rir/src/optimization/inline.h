@@ -0,0 +1,455 @@
+#ifndef RIR_OPTIMIZER_INLINE_H
+#define RIR_OPTIMIZER_INLINE_H
+
+#include "R/RList.h"
+#include "analysis/dataflow.h"
+#include "analysis_framework/manager.h"
+#include "escape.h"
+#include "interpreter/interp_context.h"
+#include "interpreter/interp_data.h"
+#include "ir/CodeEditor.h"
+#include "ir/Compiler.h"
+#include "runtime/DispatchTable.h"
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace rir {
+
+/** Inlines calls to closures with a single profiled target.
+ *
+ * The callee runs in the environment of the caller. Its formals and locals
+ * are renamed to fresh variables there, the arguments are bound to them
+ * before the body: effect free arguments (see EscapeAnalysis) as values, the
+ * others as the promise the call would have created. Arguments are matched
+ * by exact name first, then by position, missing ones take their default.
+ * The callee's code is that of its baseline version, its call sites keep
+ * their profiles, thus calls in the inlined body are candidates for the next
+ * round. Its promises which are compiled on first force are compiled right
+ * away, so that their code can be renamed as well. After the body, the
+ * renamed variables are cleared, they must not keep the callee's values
+ * alive for the rest of the caller.
+ *
+ * Moving the body to another environment must not be observable:
+ *   - the callee must not get at its environment or context: no closures,
+ *     no return, no <<-, no dots, no missing(), and it only calls safe
+ *     builtins and closures which keep their arguments local,
+ *   - it reads no free variables, and it is defined in the environment of the
+ *     caller's closure. The functions it looks up are not bound in the
+ *     caller, thus they resolve to the same binding from both environments.
+ *
+ * The inlined code has no deopt points of its own, neither the inlined call
+ * sites nor guards have an origin to continue at. Where the caller deopts,
+ * the inlined frame is not live.
+ *
+ * The cost model inlines tiny functions at every profiled call site, bigger
+ * ones only if they are called often enough, up to a limit. The caller does
+ * not grow beyond a total budget.
+ */
+class Inliner {
+  public:
+    CodeEditor& code_;
+    /// The environment the closure of the optimized code was created in
+    SEXP closureEnv_;
+
+    Inliner(CodeEditor& code, SEXP closureEnv)
+        : code_(code), closureEnv_(closureEnv) {}
+
+  private:
+    typedef std::unordered_set<SEXP> Names;
+
+    static constexpr size_t TRIVIAL_SIZE = 24;
+    static constexpr size_t MAX_CALLEE_SIZE = 300;
+    static constexpr size_t MAX_SIZE = 3000;
+    static constexpr unsigned HOT_CALLS = 50;
+
+    static size_t sizeOf(CodeEditor& e) {
+        size_t size = 0;
+        for (auto i = e.begin(); i != e.end(); ++i)
+            ++size;
+        for (size_t p = 0; p < e.numPromises(); ++p)
+            if (e.promise(p))
+                size += sizeOf(*e.promise(p));
+        return size;
+    }
+
+    static bool profitable(CallSiteProfile* p, size_t size) {
+        size_t calls = p->takenOverflow ? MAX_SIZE * 4 : p->taken;
+        if (size <= TRIVIAL_SIZE)
+            return calls > 0;
+        return calls >= HOT_CALLS &&
+               size <= std::min(MAX_CALLEE_SIZE, TRIVIAL_SIZE + calls / 4);
+    }
+
+    /** Whether the call site of the callee can stay as it is.
+     */
+    static bool safeCall(BC bc, CallSite* cs) {
+        if (cs->hasTarget)
+            return EscapeAnalysis::safeTarget(cs);
+        if (!bc.is(Opcode::call_) || !cs->hasProfile)
+            return false;
+        CallSiteProfile* p = cs->profile();
+        if (p->numTargets != 1)
+            return false;
+        SEXP t = p->targets[0];
+        if (TYPEOF(t) == BUILTINSXP)
+            return isSafeBuiltin(t->u.primsxp.offset);
+        if (TYPEOF(t) != CLOSXP || !isValidDispatchTableSEXP(BODY(t)))
+            return false;
+        return EscapeAnalysis::argumentsStayLocal(
+            DispatchTable::unpack(BODY(t))->first());
+    }
+
+    /** Checks the callee and collects the names it stores to, reads, looks
+     * up as functions and guards.
+     */
+    static bool scan(CodeEditor& e, Names& stored, Names& read, Names& funs,
+                     Names& guarded) {
+        for (auto i = e.begin(); i != e.end(); ++i) {
+            BC bc = *i;
+            if (bc.isCallsite()) {
+                if (!safeCall(bc, i.callSite()))
+                    return false;
+                continue;
+            }
+            switch (bc.bc) {
+            case Opcode::return_:
+            case Opcode::close_:
+            case Opcode::lazy_:
+            case Opcode::run_lazy_:
+            case Opcode::asast_:
+            case Opcode::stvar2_:
+            case Opcode::ldvar2_:
+            case Opcode::ldddvar_:
+            case Opcode::missing_:
+            case Opcode::guard_env_:
+                return false;
+            case Opcode::stvar_:
+            case Opcode::clear_:
+                stored.insert(bc.immediateConst());
+                break;
+            case Opcode::ldvar_:
+            case Opcode::ldlval_:
+            case Opcode::ldarg_:
+                read.insert(bc.immediateConst());
+                break;
+            case Opcode::ldfun_:
+                funs.insert(bc.immediateConst());
+                break;
+            case Opcode::guard_fun_:
+                guarded.insert(Pool::get(bc.immediate.guard_fun_args.name));
+                break;
+            default:
+                break;
+            }
+        }
+        for (size_t p = 0; p < e.numPromises(); ++p)
+            if (e.promise(p) &&
+                !scan(*e.promise(p), stored, read, funs, guarded))
+                return false;
+        return true;
+    }
+
+    /** Compiles the promises of e which would be compiled on first force.
+     */
+    static void compileLazy(CodeEditor& e) {
+        for (size_t p = 0; p < e.numPromises(); ++p) {
+            CodeEditor* prom = e.promise(p);
+            if (!prom)
+                continue;
+            auto i = prom->begin();
+            if (i != prom->end() && (i + 1) != prom->end() &&
+                (*(i + 1)).is(Opcode::ret_) && (i + 2) == prom->end() &&
+                ((*i).is(Opcode::lazy_) || (*i).is(Opcode::run_lazy_))) {
+                BC bc = *i;
+                Protect protect;
+                SEXP fun =
+                    bc.is(Opcode::lazy_)
+                        ? protect(
+                              Compiler::compileExpression(bc.immediateConst()))
+                        : Pool::get(bc.immediate.pool);
+                prom = new CodeEditor(Function::unpack(fun)->body());
+                e.replacePromise(p, prom);
+            }
+            compileLazy(*prom);
+        }
+    }
+
+    /** The names the caller binds in its own environment.
+     */
+    static void bound(CodeEditor& e, Names& names) {
+        for (auto i = e.begin(); i != e.end(); ++i)
+            if ((*i).is(Opcode::stvar_) || (*i).is(Opcode::clear_))
+                names.insert((*i).immediateConst());
+        for (size_t p = 0; p < e.numPromises(); ++p)
+            if (e.promise(p))
+                bound(*e.promise(p), names);
+    }
+
+    static SEXP fresh(SEXP name) {
+        static unsigned count = 0;
+        std::string n = ".inl" + std::to_string(count++) + "." +
+                         CHAR(PRINTNAME(name));
+        return Rf_install(n.c_str());
+    }
+
+    static void rename(CodeEditor& e,
+                       const std::unordered_map<SEXP, SEXP>& names) {
+        for (size_t p = 0; p < e.numPromises(); ++p)
+            if (e.promise(p))
+                rename(*e.promise(p), names);
+
+        for (auto i = e.begin(); i != e.end(); ++i) {
+            BC bc = *i;
+            switch (bc.bc) {
+            case Opcode::ldvar_:
+            case Opcode::ldlval_:
+            case Opcode::ldarg_:
+            case Opcode::stvar_:
+            case Opcode::clear_:
+            case Opcode::ldfun_:
+                break;
+            default:
+                continue;
+            }
+            auto n = names.find(bc.immediateConst());
+            if (n == names.end())
+                continue;
+
+            auto cur = i.asCursor(e);
+            cur.remove();
+            switch (bc.bc) {
+            case Opcode::ldlval_:
+                cur << BC::ldlval(n->second);
+                break;
+            case Opcode::stvar_:
+                cur << BC::stvar(n->second);
+                break;
+            case Opcode::clear_:
+                cur << BC::clear(n->second);
+                break;
+            case Opcode::ldfun_:
+                cur << BC::ldfun(n->second);
+                break;
+            default:
+                // the argument is an ordinary variable now
+                cur << BC::ldvar(n->second);
+                break;
+            }
+            if (i.srcIdx())
+                cur.addSrcIdx(i.srcIdx());
+        }
+        if (e.changed)
+            e.commit();
+    }
+
+    /** Matches the arguments of the call to the formals. Gives the index of
+     * the argument for every formal, or MISSING_ARG_IDX.
+     */
+    static bool match(CallSite* cs, const std::vector<SEXP>& formals,
+                      std::vector<unsigned>& args) {
+        args.assign(formals.size(), MISSING_ARG_IDX);
+        std::vector<bool> given(formals.size(), false);
+        std::vector<bool> named(cs->nargs, false);
+
+        for (size_t a = 0; a < cs->nargs; ++a) {
+            if (cs->args()[a] == DOTS_ARG_IDX)
+                return false;
+            if (!cs->hasNames)
+                continue;
+            SEXP name = Pool::get(cs->names()[a]);
+            if (TYPEOF(name) != SYMSXP || !*CHAR(PRINTNAME(name)))
+                continue;
+            // No partial matching
+            auto f = std::find(formals.begin(), formals.end(), name);
+            if (f == formals.end() || given[f - formals.begin()])
+                return false;
+            args[f - formals.begin()] = cs->args()[a];
+            given[f - formals.begin()] = true;
+            named[a] = true;
+        }
+
+        size_t f = 0;
+        for (size_t a = 0; a < cs->nargs; ++a) {
+            if (named[a])
+                continue;
+            while (f < formals.size() && given[f])
+                ++f;
+            if (f == formals.size())
+                return false;
+            args[f] = cs->args()[a];
+            given[f] = true;
+        }
+        return true;
+    }
+
+    /** The callee with renamed locals, and the code binding its formals.
+     * Compiled default arguments are promises of the callee, the index they
+     * get in the caller is only known when the callee is inserted.
+     */
+    struct Inlinee {
+        CodeEditor* body;
+        std::vector<BC> bindings;
+        std::vector<std::pair<unsigned, SEXP>> defaults;
+        std::vector<SEXP> locals;
+    };
+
+    bool prepare(CodeEditor::Iterator call, SEXP t, Inlinee& res,
+                 DataflowAnalysis<Type::Conservative>& dataflow,
+                 const Names& callerNames) {
+        CodeEditor& body = *res.body;
+        CallSite* cs = call.callSite();
+
+        // Otherwise the names it looks up might resolve to something else
+        if (CLOENV(t) != closureEnv_)
+            return false;
+
+        std::vector<SEXP> formals;
+        std::vector<SEXP> defaults;
+        for (auto f = RList(FORMALS(t)).begin(); f != RList::end(); ++f) {
+            if (f.tag() == R_DotsSymbol)
+                return false;
+            formals.push_back(f.tag());
+            defaults.push_back(*f);
+        }
+
+        std::vector<unsigned> args;
+        if (!match(cs, formals, args))
+            return false;
+
+        compileLazy(body);
+
+        Names stored, read, funs, guarded;
+        if (!scan(body, stored, read, funs, guarded))
+            return false;
+
+        Names locals(formals.begin(), formals.end());
+        locals.insert(stored.begin(), stored.end());
+        for (auto n : read)
+            if (!locals.count(n))
+                return false;
+        for (auto n : funs)
+            if (!locals.count(n) && callerNames.count(n))
+                return false;
+        for (auto n : guarded)
+            if (locals.count(n) || callerNames.count(n))
+                return false;
+
+        std::unordered_map<SEXP, SEXP> names;
+        for (auto n : locals) {
+            names[n] = fresh(n);
+            res.locals.push_back(names[n]);
+        }
+
+        size_t compiledDefault = 0;
+        for (size_t f = 0; f < formals.size(); ++f) {
+            SEXP var = names.at(formals[f]);
+            SEXP dflt = defaults[f];
+            bool hasDefault = dflt != R_MissingArg;
+            size_t d = hasDefault ? compiledDefault++ : 0;
+
+            unsigned idx = args[f];
+            if (idx != MISSING_ARG_IDX) {
+                if (EscapeAnalysis::effectFree(code_, idx, call, dataflow)) {
+                    res.bindings.push_back(*code_.promise(idx)->begin());
+                    res.bindings.push_back(BC::setShared());
+                } else {
+                    res.bindings.push_back(BC::promise(idx));
+                }
+            } else if (!hasDefault) {
+                return false;
+            } else if (TYPEOF(dflt) != SYMSXP && TYPEOF(dflt) != LANGSXP &&
+                       TYPEOF(dflt) != PROMSXP) {
+                res.bindings.push_back(BC::push(dflt));
+                res.bindings.push_back(BC::setShared());
+            } else {
+                if (d >= body.numDefaultArguments())
+                    return false;
+                res.defaults.push_back({body.defaultArgument(d), var});
+                continue;
+            }
+            res.bindings.push_back(BC::stvar(var));
+        }
+
+        rename(body, names);
+        body.normalizeForInline();
+        return true;
+    }
+
+  public:
+    void run() {
+        if (code_.begin() == code_.end())
+            return;
+
+        // Analyses are computed before anything changes
+        auto& dataflow =
+            code_.analyses().get<DataflowAnalysis<Type::Conservative>>();
+
+        Names callerNames;
+        bound(code_, callerNames);
+        for (auto a : code_.arguments())
+            callerNames.insert(a.first);
+
+        size_t size = sizeOf(code_);
+
+        for (auto i = code_.begin(); i != code_.end(); ++i) {
+            if (!(*i).is(Opcode::call_))
+                continue;
+
+            CallSite* cs = i.callSite();
+            if (!cs->hasProfile)
+                continue;
+            CallSiteProfile* p = cs->profile();
+            if (p->numTargets != 1)
+                continue;
+
+            SEXP t = p->targets[0];
+            if (TYPEOF(t) != CLOSXP || !isValidDispatchTableSEXP(BODY(t)))
+                continue;
+
+            CodeEditor::Cursor cur = i.asCursor(code_).prev();
+            if (!cur.bc().is(Opcode::ldfun_))
+                continue;
+            SEXP name = cur.bc().immediateConst();
+
+            Function* f = DispatchTable::unpack(BODY(t))->first();
+            if (f->envLeaked)
+                continue;
+            while (f->origin())
+                f = Function::unpack(f->origin());
+
+            CodeEditor body(f->container());
+            body.formals_ = FORMALS(t);
+            size_t bodySize = sizeOf(body);
+            if (!profitable(p, bodySize) || size + bodySize > MAX_SIZE)
+                continue;
+
+            Inlinee inlinee = {&body, {}, {}, {}};
+            if (!prepare(i, t, inlinee, dataflow, callerNames))
+                continue;
+
+            cur.remove();
+            cur.remove();
+            if (cur.bc().is(Opcode::guard_env_))
+                cur.remove();
+
+            cur << BC::guardName(name, t);
+            for (auto bc : inlinee.bindings)
+                cur << bc;
+            // insert() appends the promises of the body to ours
+            size_t promises = code_.numPromises();
+            for (auto d : inlinee.defaults)
+                cur << BC::promise(promises + d.first) << BC::stvar(d.second);
+            cur.insert(body);
+            for (auto n : inlinee.locals)
+                cur << BC::clear(n);
+
+            size += bodySize;
+        }
+    }
+};
+}
+#endif
@@ -0,0 +1,228 @@
+#ifndef RIR_OPTIMIZER_LICM_H
+#define RIR_OPTIMIZER_LICM_H
+
+#include "analysis/dataflow.h"
+#include "analysis/loops.h"
+#include "analysis/types.h"
+#include "analysis_framework/manager.h"
+#include "dead_store.h"
+
+#include <map>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace rir {
+
+/** Moves loop invariant code into the loop preheader.
+ *
+ * Guards: guard_fun_ only asserts that the name still refers to the primitive
+ * the compiler inlined, the inlined instructions never look at the binding.
+ * There is no deopt behind it, so it may only move if nothing in the loop can
+ * rebind the name: the loop does not assign it, calls nothing but safe
+ * builtins and the environment has not leaked at the loop header (according
+ * to the type analysis, this covers the end of the loop body as well).
+ *
+ * Computations: a load of a variable the loop does not store to, followed by
+ * length_, names_, is_ or isfun_ on the loaded value, is computed once into a
+ * fresh local variable, which the loop then reads instead. This needs a
+ * private environment, otherwise calls in the loop could change the variable,
+ * and the load must not have any effects, unless it runs on every entry into
+ * the loop before anything else with effects. A variable the type analysis
+ * knows to hold a plain vector is bound to a value, loading it has none.
+ *
+ * Loops are processed innermost first, code hoisted out of an inner loop is
+ * considered for the outer loop the next time the pass runs.
+ */
+class LoopInvariantCodeMotion {
+  public:
+    CodeEditor& code_;
+
+    LoopInvariantCodeMotion(CodeEditor& code) : code_(code) {}
+
+  private:
+    typedef LoopAnalysis::Loop Loop;
+
+    std::vector<bool> moved_;
+    std::unordered_set<SEXP> locals_;
+    unsigned tmpIdx_ = 0;
+
+    static bool invariantOp(BC bc) {
+        switch (bc.bc) {
+        case Opcode::length_:
+        case Opcode::names_:
+        case Opcode::is_:
+        case Opcode::isfun_:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    SEXP freshLocal() {
+        SEXP sym;
+        do {
+            sym = Rf_install((".licm" + std::to_string(tmpIdx_++)).c_str());
+        } while (locals_.count(sym));
+        locals_.insert(sym);
+        return sym;
+    }
+
+    /** Whether no code but the loop's own can run while it does.
+     */
+    static bool isolated(const Loop& loop, const LoopAnalysis& loops,
+                         TypeAnalysis& types) {
+        if (loop.begin + 1 > loop.end ||
+            types[loops.instructions[loop.begin + 1]]
+                .global()
+                .leaksEnvironment)
+            return false;
+        for (size_t pos = loop.begin; pos <= loop.end; ++pos) {
+            auto ins = loops.instructions[pos];
+            if (!(*ins).isCallsite())
+                continue;
+            CallSite* cs = ins.callSite();
+            if (!cs->hasTarget)
+                return false;
+            SEXP target = Pool::get(*cs->target());
+            if (TYPEOF(target) != BUILTINSXP ||
+                !isSafeBuiltin(target->u.primsxp.offset))
+                return false;
+        }
+        return true;
+    }
+
+    void hoistGuards(const Loop& loop, const LoopAnalysis& loops,
+                     const std::unordered_set<SEXP>& stored) {
+        std::unordered_set<SEXP> hoisted;
+        for (size_t pos = loop.begin; pos <= loop.end; ++pos) {
+            auto ins = loops.instructions[pos];
+            BC bc = *ins;
+            if (moved_[pos] || !bc.is(Opcode::guard_fun_))
+                continue;
+            SEXP sym = Pool::get(bc.immediate.guard_fun_args.name);
+            if (stored.count(sym))
+                continue;
+            ins.asCursor(code_).remove();
+            if (hoisted.insert(sym).second) {
+                auto preheader = loop.preheader;
+                preheader.asCursor(code_) << bc;
+            }
+            moved_[pos] = true;
+        }
+    }
+
+    void hoistComputations(const Loop& loop, const LoopAnalysis& loops,
+                           const std::unordered_set<SEXP>& stored,
+                           DataflowAnalysis<Type::Conservative>& dataflow,
+                           TypeAnalysis& types) {
+        // Loads in this prefix of the header run whenever the loop is entered
+        // and nothing with effects runs before them
+        bool prefix = true;
+        std::map<std::vector<unsigned>, SEXP> hoisted;
+
+        for (size_t pos = loop.begin + 1; pos <= loop.end; ++pos) {
+            auto ins = loops.instructions[pos];
+            BC bc = *ins;
+            bool load = bc.is(Opcode::ldvar_) || bc.is(Opcode::ldlval_);
+            bool effectFree =
+                bc.is(Opcode::ldlval_) ||
+                (bc.is(Opcode::ldvar_) &&
+                 (dataflow[ins][bc.immediateConst()].isValue() ||
+                  types[ins][bc.immediateConst()].isPlain()));
+
+            if (load && !moved_[pos] && !stored.count(bc.immediateConst()) &&
+                (effectFree || prefix)) {
+                std::vector<unsigned> key = {bc.immediate.pool};
+                size_t end = pos + 1;
+                while (end <= loop.end && !moved_[end] &&
+                       invariantOp(*loops.instructions[end])) {
+                    BC op = *loops.instructions[end];
+                    key.push_back((unsigned)op.bc);
+                    key.push_back(op.is(Opcode::is_) ? op.immediate.i : 0);
+                    ++end;
+                }
+
+                if (end > pos + 1) {
+                    auto h = hoisted.find(key);
+                    if (h == hoisted.end()) {
+                        SEXP tmp = freshLocal();
+                        auto preheader = loop.preheader;
+                        auto cur = preheader.asCursor(code_);
+                        for (size_t i = pos; i < end; ++i)
+                            cur << *loops.instructions[i];
+                        cur << BC::stvar(tmp);
+                        h = hoisted.emplace(key, tmp).first;
+                    }
+
+                    auto cur = ins.asCursor(code_);
+                    for (size_t i = pos; i < end; ++i) {
+                        cur.remove();
+                        moved_[i] = true;
+                    }
+                    cur << BC::ldlval(h->second);
+                    pos = end - 1;
+                    continue;
+                }
+            }
+
+            if (bc.isJmp() || bc.isLabel() || (!bc.isPure() && !effectFree))
+                prefix = false;
+        }
+    }
+
+  public:
+    void run() {
+        if (code_.begin() == code_.end())
+            return;
+
+        auto& loops = code_.analyses().get<LoopAnalysis>();
+        if (loops.loops.empty())
+            return;
+
+        auto& dataflow =
+            code_.analyses().get<DataflowAnalysis<Type::Conservative>>();
+        auto& types = code_.analyses().get<TypeAnalysis>();
+        bool privateEnv = DeadStoreElimination::envIsPrivate(code_);
+
+        moved_.assign(loops.instructions.size(), false);
+        tmpIdx_ = 0;
+        locals_.clear();
+        for (auto ins : loops.instructions) {
+            switch ((*ins).bc) {
+            case Opcode::ldvar_:
+            case Opcode::ldlval_:
+            case Opcode::ldarg_:
+            case Opcode::ldddvar_:
+            case Opcode::ldfun_:
+            case Opcode::stvar_:
+            case Opcode::stvar2_:
+            case Opcode::missing_:
+                locals_.insert((*ins).immediateConst());
+                break;
+            default:
+                break;
+            }
+        }
+
+        for (auto& loop : loops.loops) {
+            if (loop.preheader == code_.end())
+                continue;
+
+            std::unordered_set<SEXP> stored;
+            for (size_t pos = loop.begin; pos <= loop.end; ++pos) {
+                BC bc = *loops.instructions[pos];
+                if (bc.is(Opcode::stvar_) || bc.is(Opcode::stvar2_) ||
+                    bc.is(Opcode::clear_))
+                    stored.insert(bc.immediateConst());
+            }
+
+            if (isolated(loop, loops, types))
+                hoistGuards(loop, loops, stored);
+            if (privateEnv)
+                hoistComputations(loop, loops, stored, dataflow, types);
+        }
+    }
+};
+}
+#endif
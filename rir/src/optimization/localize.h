@@ -2,13 +2,14 @@
 #define RIR_LOCALIZE_H
 
 #include "analysis/dataflow.h"
+#include "analysis_framework/manager.h"
 #include "interpreter/deoptimizer.h"
 
 namespace rir {
 
 class Localizer : public InstructionDispatcher::Receiver {
   public:
-    DataflowAnalysis<Type::Conservative> analysis;
+    DataflowAnalysis<Type::Conservative>& analysis;
     InstructionDispatcher dispatcher;
     CodeEditor& code_;
     CodeEditor::Iterator lastCall;
@@ -16,10 +17,17 @@ class Localizer : public InstructionDispatcher::Receiver {
     bool steam;
 
     Localizer(CodeEditor& code, bool envIsStable)
-        : dispatcher(*this), code_(code), initSteam(envIsStable) {}
+        : analysis(
+              code.analyses().get<DataflowAnalysis<Type::Conservative>>()),
+          dispatcher(*this), code_(code), initSteam(envIsStable) {}
 
     void asbool_(CodeEditor::Iterator ins) override { lastCall = ins; }
 
+    void any(CodeEditor::Iterator ins) override {
+        if ((*ins).isRelopJmp())
+            lastCall = ins;
+    }
+
     void call_(CodeEditor::Iterator ins) override { lastCall = ins; }
 
     void dispatch_(CodeEditor::Iterator ins) override { lastCall = ins; }
@@ -71,7 +79,9 @@ class Localizer : public InstructionDispatcher::Receiver {
         // guard_env on this ldvar-site will only become apparent on the next
         // run of this optimization pass (we assume it's run multiple times).
 
-        if (steam && lastCall != code_.end()) {
+        // A guard cannot be placed right after a fused compare and branch,
+        // since it would only cover the fallthrough.
+        if (steam && lastCall != code_.end() && !(*lastCall).isJmp()) {
             auto vb = analysis[lastCall][sym];
             if (vb.isValue() || vb.t == FValue::Type::Argument) {
                 if (lastCall.hasOrigin()) {
@@ -93,7 +103,7 @@ class Localizer : public InstructionDispatcher::Receiver {
     void run() {
         steam = initSteam;
         lastCall = code_.end();
-        analysis.analyze(code_);
+        code_.analyses().get<DataflowAnalysis<Type::Conservative>>();
         for (auto i = code_.begin(); i != code_.end(); ++i) {
             dispatcher.dispatch(i);
         }
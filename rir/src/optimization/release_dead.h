@@ -0,0 +1,87 @@
+#ifndef RIR_OPTIMIZER_RELEASE_DEAD_H
+#define RIR_OPTIMIZER_RELEASE_DEAD_H
+
+#include "analysis/liveness.h"
+#include "analysis/types.h"
+#include "analysis_framework/manager.h"
+#include "optimization/dead_store.h"
+
+#include <unordered_set>
+
+namespace rir {
+
+/** Clears local bindings right after their last use, so that big
+ * intermediate values can be collected before the function returns.
+ *
+ * Like dead store elimination this needs the environment to be private to
+ * the function. Uses directly followed by a return are left alone, the frame
+ * goes away anyway. So are variables stored again before the basic block
+ * ends, like s in s <- s + x, and variables the type analysis knows to hold a
+ * scalar, releasing those gains nothing.
+ */
+class ReleaseDeadLocals {
+  public:
+    CodeEditor& code_;
+
+    ReleaseDeadLocals(CodeEditor& code) : code_(code) {}
+
+    /** Whether sym is stored to after pos, before control leaves its block.
+     */
+    bool storedInBlock(CodeEditor::Iterator pos, SEXP sym) {
+        for (; pos != code_.end(); ++pos) {
+            BC bc = *pos;
+            if (bc.isLabel() || bc.isJmp() || bc.isReturn())
+                return false;
+            if (bc.is(Opcode::stvar_) && bc.immediateConst() == sym)
+                return true;
+        }
+        return false;
+    }
+
+    void run() {
+        if (code_.begin() == code_.end() ||
+            !DeadStoreElimination::envIsPrivate(code_))
+            return;
+
+        // Only variables assigned by this function, arguments are usually
+        // still referenced by the caller
+        std::unordered_set<SEXP> locals;
+        for (auto i = code_.begin(); i != code_.end(); ++i)
+            if ((*i).is(Opcode::stvar_))
+                locals.insert((*i).immediateConst());
+        if (locals.empty())
+            return;
+
+        auto& liveness = code_.analyses().get<LivenessAnalysis>();
+        auto& types = code_.analyses().get<TypeAnalysis>();
+
+        // A variable dies at its last use, the only instructions which can
+        // remove it from the live set (besides stores, which define it anew)
+        for (auto i = code_.rbegin(); i != code_.rend(); --i) {
+            BC bc = *i;
+            switch (bc.bc) {
+            case Opcode::ldvar_:
+            case Opcode::ldlval_:
+            case Opcode::ldddvar_:
+            case Opcode::ldarg_:
+            case Opcode::ldfun_:
+                break;
+            default:
+                continue;
+            }
+            auto next = i + 1;
+            if (next == code_.end() || code_.isExitPoint(next))
+                continue;
+
+            SEXP sym = bc.immediateConst();
+            if (!locals.count(sym) || types[i][sym].isScalar() ||
+                storedInBlock(next, sym))
+                continue;
+            auto& live = liveness[next].getState().variables;
+            if (live.find(sym) == live.end())
+                next.asCursor(code_) << BC::clear(sym);
+        }
+    }
+};
+}
+#endif
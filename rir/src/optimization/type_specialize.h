@@ -0,0 +1,74 @@
+#ifndef RIR_OPTIMIZER_TYPE_SPECIALIZE_H
+#define RIR_OPTIMIZER_TYPE_SPECIALIZE_H
+
+#include "analysis/types.h"
+#include "analysis_framework/manager.h"
+
+#include <utility>
+#include <vector>
+
+namespace rir {
+
+/** Replaces arithmetic and fused compare and branch instructions by their
+ * typed variants where the TypeAnalysis proves both operands to be simple
+ * scalars of the same type, integer or double. The typed instructions skip
+ * the type tests and the fallback to the builtin.
+ *
+ * Integer arithmetic on operands which cannot be NA and whose ranges keep
+ * the result within the integers needs no NA and overflow checks either.
+ */
+class TypeSpecialization {
+  public:
+    CodeEditor& code_;
+
+    TypeSpecialization(CodeEditor& code) : code_(code) {}
+
+    static SEXPTYPE scalars(TValue lhs, TValue rhs) {
+        if (lhs.t == TValue::Type::Int && rhs.t == TValue::Type::Int)
+            return INTSXP;
+        if (lhs.t == TValue::Type::Real && rhs.t == TValue::Type::Real)
+            return REALSXP;
+        return NILSXP;
+    }
+
+    void run() {
+        if (code_.begin() == code_.end())
+            return;
+
+        auto& types = code_.analyses().get<TypeAnalysis>();
+
+        // The analysis is computed before anything changes
+        std::vector<std::pair<CodeEditor::Iterator, BC>> rewrites;
+        for (auto i = code_.begin(); i != code_.end(); ++i) {
+            BC bc = *i;
+            bool candidate = !bc.isLabel() &&
+                             (BC::specialize(bc, REALSXP).bc != bc.bc ||
+                              BC::uncheckedInt(bc).bc != bc.bc);
+            if (!candidate)
+                continue;
+            auto& stack = types[i].stack();
+            TValue lhs = stack[1];
+            TValue rhs = stack[0];
+            SEXPTYPE t = scalars(lhs, rhs);
+            if (t == NILSXP)
+                continue;
+            BC typed = BC::specialize(bc, t);
+            if (t == INTSXP &&
+                !TypeAnalysis::intArith(bc.bc, lhs, rhs).maybeNA())
+                typed = BC::uncheckedInt(typed);
+            if (typed.bc != bc.bc)
+                rewrites.push_back(std::make_pair(i, typed));
+        }
+
+        for (auto& r : rewrites) {
+            auto cur = r.first.asCursor(code_);
+            unsigned src = cur.srcIdx();
+            cur.remove();
+            cur << r.second;
+            if (src)
+                cur.addSrcIdx(src);
+        }
+    }
+};
+}
+#endif
@@ -0,0 +1,348 @@
+#ifndef RIR_OPTIMIZER_VALUE_NUMBERING_H
+#define RIR_OPTIMIZER_VALUE_NUMBERING_H
+
+#include "analysis/dataflow.h"
+#include "analysis_framework/manager.h"
+#include "dead_store.h"
+
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+namespace rir {
+
+/** Value numbering on the operand stack.
+ *
+ * Every value pushed gets a number, values computed by the same instruction
+ * from the same numbered arguments get the same number. Loads of a variable
+ * get the number of the value last stored to or loaded from it. If an
+ * instruction recomputes a value which is still somewhere on the stack, it is
+ * replaced by a pull_ of that value (plus pops of its arguments, which the
+ * cleanup pass removes together with their definitions if possible).
+ *
+ * The stack machine has no other place to keep values around, thus only
+ * values still on the stack can be reused. Numbers are local to extended basic
+ * blocks: they survive conditional branches on the fallthrough path, but not
+ * labels.
+ *
+ * Reused are loads of variables holding values, the pure extract and length
+ * instructions and arithmetic on values which cannot be objects (constants,
+ * lengths and arithmetic on those), since those cannot dispatch. Anything
+ * that might run arbitrary code forgets all numbers.
+ */
+class ValueNumbering {
+  public:
+    CodeEditor& code_;
+
+    ValueNumbering(CodeEditor& code) : code_(code) {}
+
+  private:
+    typedef unsigned VN;
+    typedef std::vector<unsigned> Key;
+
+    /// the known top part of the stack, top at the back
+    std::vector<VN> stack_;
+    std::unordered_map<SEXP, VN> vars_;
+    std::map<Key, VN> exprs_;
+    /// indexed by VN, whether the value can not be an object
+    std::vector<bool> plain_;
+
+    VN fresh(bool plain = false) {
+        plain_.push_back(plain);
+        return plain_.size() - 1;
+    }
+
+    VN pop() {
+        if (stack_.empty())
+            return fresh();
+        VN v = stack_.back();
+        stack_.pop_back();
+        return v;
+    }
+
+    /** Position of v from the top, not looking at the topmost skip entries,
+     * or -1 if it is not on the known part of the stack.
+     */
+    int find(VN v, size_t skip) {
+        if (stack_.size() <= skip)
+            return -1;
+        size_t s = stack_.size() - skip;
+        for (size_t pos = s; pos > 0; --pos)
+            if (stack_[pos - 1] == v)
+                return s - pos;
+        return -1;
+    }
+
+    void forget() {
+        vars_.clear();
+        exprs_.clear();
+    }
+
+    void reset() {
+        stack_.clear();
+        forget();
+    }
+
+    /** Replaces ins, which has nargs arguments, by a copy of the value at
+     * depth n below them.
+     */
+    void reuse(CodeEditor::Iterator ins, size_t nargs, int n) {
+        CodeEditor::Cursor cur = ins.asCursor(code_);
+        cur.remove();
+        for (size_t i = 0; i < nargs; ++i)
+            cur << BC::pop();
+        // the value is referenced twice now
+        cur << BC::pull(n) << BC::setShared();
+    }
+
+    void load(CodeEditor::Iterator ins, SEXP sym, bool pure) {
+        auto v = vars_.find(sym);
+        if (v != vars_.end()) {
+            int n = find(v->second, 0);
+            if (n != -1)
+                reuse(ins, 0, n);
+            stack_.push_back(v->second);
+            return;
+        }
+        if (!pure)
+            forget();
+        VN res = fresh();
+        vars_[sym] = res;
+        stack_.push_back(res);
+    }
+
+    void expr(CodeEditor::Iterator ins, unsigned imm, bool plainResult) {
+        BC bc = *ins;
+        size_t nargs = bc.popCount();
+
+        Key key = {(unsigned)bc.bc, imm};
+        for (size_t i = 0; i < nargs; ++i) {
+            VN arg = i < stack_.size() ? stack_[stack_.size() - 1 - i]
+                                       : fresh();
+            key.push_back(arg);
+        }
+
+        auto e = exprs_.find(key);
+        if (e != exprs_.end()) {
+            int n = find(e->second, nargs);
+            if (n != -1)
+                reuse(ins, nargs, n);
+            for (size_t i = 0; i < nargs; ++i)
+                pop();
+            stack_.push_back(e->second);
+            return;
+        }
+
+        for (size_t i = 0; i < nargs; ++i)
+            pop();
+        VN res = fresh(plainResult);
+        exprs_[key] = res;
+        stack_.push_back(res);
+    }
+
+    bool plainArgs(size_t nargs) {
+        if (stack_.size() < nargs)
+            return false;
+        for (size_t i = 0; i < nargs; ++i)
+            if (!plain_[stack_[stack_.size() - 1 - i]])
+                return false;
+        return true;
+    }
+
+    void other(BC bc) {
+        size_t nargs = bc.popCount();
+        for (size_t i = 0; i < nargs; ++i)
+            pop();
+        if (!bc.isPure())
+            forget();
+        for (size_t i = 0; i < bc.pushCount(); ++i)
+            stack_.push_back(fresh());
+    }
+
+  public:
+    void run() {
+        if (code_.begin() == code_.end())
+            return;
+
+        auto& analysis =
+            code_.analyses().get<DataflowAnalysis<Type::Conservative>>();
+        // Forcing a promise might change our variables only if somebody else
+        // can see the environment
+        bool privateEnv = DeadStoreElimination::envIsPrivate(code_);
+
+        reset();
+        plain_.clear();
+
+        for (auto ins = code_.begin(); ins != code_.end(); ++ins) {
+            BC bc = *ins;
+            if (bc.isLabel()) {
+                reset();
+                continue;
+            }
+
+            switch (bc.bc) {
+            case Opcode::br_:
+            case Opcode::ret_:
+            case Opcode::return_:
+                // the next instruction is only reachable through a label
+                reset();
+                break;
+
+            case Opcode::pick_:
+            case Opcode::put_:
+                stack_.clear();
+                break;
+
+            case Opcode::brobj_:
+                break;
+
+            case Opcode::pop_:
+                pop();
+                break;
+
+            case Opcode::dup_: {
+                VN a = pop();
+                stack_.push_back(a);
+                stack_.push_back(a);
+                break;
+            }
+
+            case Opcode::dup2_: {
+                VN b = pop();
+                VN a = pop();
+                stack_.insert(stack_.end(), {a, b, a, b});
+                break;
+            }
+
+            case Opcode::swap_: {
+                VN b = pop();
+                VN a = pop();
+                stack_.push_back(b);
+                stack_.push_back(a);
+                break;
+            }
+
+            case Opcode::pull_: {
+                size_t n = bc.immediate.i;
+                stack_.push_back(n < stack_.size()
+                                     ? stack_[stack_.size() - 1 - n]
+                                     : fresh());
+                break;
+            }
+
+            case Opcode::push_: {
+                Key key = {(unsigned)bc.bc, bc.immediate.pool};
+                auto e = exprs_.find(key);
+                if (e == exprs_.end()) {
+                    VN res = fresh(!isObject(bc.immediateConst()));
+                    e = exprs_.emplace(key, res).first;
+                }
+                stack_.push_back(e->second);
+                break;
+            }
+
+            case Opcode::ldlval_:
+                load(ins, bc.immediateConst(), true);
+                break;
+
+            case Opcode::ldvar_: {
+                SEXP sym = bc.immediateConst();
+                // the binding held a value already if it still does now
+                bool pure = analysis[ins][sym].isValue();
+                if (pure || privateEnv) {
+                    load(ins, sym, pure);
+                } else {
+                    forget();
+                    stack_.push_back(fresh());
+                }
+                break;
+            }
+
+            case Opcode::stvar_: {
+                VN v = pop();
+                SEXP sym = bc.immediateConst();
+                // Others might see the store, or the binding might be active
+                if (privateEnv)
+                    vars_[sym] = v;
+                else
+                    forget();
+                break;
+            }
+
+            case Opcode::clear_:
+                vars_.erase(bc.immediateConst());
+                break;
+
+            case Opcode::extract1_:
+            case Opcode::extract1_unchecked_:
+            case Opcode::subset1_:
+            case Opcode::extract2_:
+            case Opcode::subset2_:
+            case Opcode::names_:
+                expr(ins, 0, false);
+                break;
+
+            case Opcode::length_:
+            case Opcode::isfun_:
+            case Opcode::lgl_or_:
+            case Opcode::lgl_and_:
+                expr(ins, 0, true);
+                break;
+
+            case Opcode::is_:
+                expr(ins, bc.immediate.i, true);
+                break;
+
+            case Opcode::add_:
+            case Opcode::sub_:
+            case Opcode::mul_:
+            case Opcode::div_:
+            case Opcode::idiv_:
+            case Opcode::mod_:
+            case Opcode::pow_:
+            case Opcode::add_int_:
+            case Opcode::sub_int_:
+            case Opcode::mul_int_:
+            case Opcode::add_int_unchecked_:
+            case Opcode::sub_int_unchecked_:
+            case Opcode::mul_int_unchecked_:
+            case Opcode::add_real_:
+            case Opcode::sub_real_:
+            case Opcode::mul_real_:
+            case Opcode::div_real_:
+            case Opcode::lt_:
+            case Opcode::gt_:
+            case Opcode::le_:
+            case Opcode::ge_:
+            case Opcode::eq_:
+            case Opcode::ne_:
+            case Opcode::uplus_:
+            case Opcode::uminus_:
+            case Opcode::not_:
+                if (plainArgs(bc.popCount()))
+                    expr(ins, 0, true);
+                else
+                    other(bc);
+                break;
+
+            // These modify their argument in place, which changes the values
+            // of expressions computed from it
+            case Opcode::subassign_:
+            case Opcode::subassign2_:
+            case Opcode::set_names_:
+            case Opcode::inc_:
+            case Opcode::for_step_:
+            case Opcode::stvar2_:
+                other(bc);
+                forget();
+                break;
+
+            default:
+                other(bc);
+                break;
+            }
+        }
+    }
+};
+}
+#endif
@@ -50,6 +50,7 @@ struct CallSite;
 struct Code {
     friend class FunctionWriter;
     friend class CodeVerifier;
+    friend class Serializer;
 
     Code() = delete;
 
@@ -200,7 +201,9 @@ struct CallSite {
     uint32_t hasTarget : 1;
     uint32_t hasImmediateArgs : 1;
     uint32_t hasProfile : 1;
-    uint32_t free : 27;
+    /// Closures whose Function has argsLocal get the arguments as values
+    uint32_t eagerArgs : 1;
+    uint32_t free : 26;
 
     // This is duplicated in the BC instruction, not sure how to avoid
     // without making accessing the payload a pain...
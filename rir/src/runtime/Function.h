@@ -66,6 +66,8 @@ struct Function {
         foffset = 0;
         invocationCount = 0;
         markOpt = false;
+        contextFree = false;
+        argsLocal = false;
     }
 
     SEXP container() {
@@ -144,7 +146,9 @@ public:
     unsigned envChanged : 1;
     unsigned deopt : 1;
     unsigned markOpt : 1;
-    unsigned spare : 28;
+    unsigned contextFree : 1; /// can be called without a RCNTXT
+    unsigned argsLocal : 1; /// promises passed in cannot escape
+    unsigned spare : 26;
 
     unsigned codeLength; /// number of Code objects in the Function
 
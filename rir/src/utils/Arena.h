@@ -0,0 +1,57 @@
+#ifndef RIR_ARENA_H
+#define RIR_ARENA_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdlib>
+#include <vector>
+
+namespace rir {
+
+/** A bump allocator. Memory is handed out from large chunks and only released
+ *  all at once, when the arena is destroyed. Pointers into the arena stay
+ *  valid for its whole lifetime.
+ */
+class Arena {
+  public:
+    static constexpr size_t chunkSize = 16 * 1024;
+    static constexpr size_t alignment = alignof(std::max_align_t);
+
+    Arena() {}
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    ~Arena() {
+        for (auto c : chunks)
+            free(c);
+    }
+
+    void* alloc(size_t size) {
+        size = (size + alignment - 1) & ~(alignment - 1);
+        if (size > left) {
+            // oversized requests get their own chunk, the current one is kept
+            size_t n = chunkSize;
+            if (size > n)
+                n = size;
+            char* chunk = (char*)malloc(n);
+            assert(chunk);
+            chunks.push_back(chunk);
+            if (n != chunkSize)
+                return chunk;
+            next = chunk;
+            left = n;
+        }
+        void* res = next;
+        next += size;
+        left -= size;
+        return res;
+    }
+
+  private:
+    std::vector<char*> chunks;
+    char* next = nullptr;
+    size_t left = 0;
+};
+}
+
+#endif
@@ -0,0 +1,220 @@
+#include "Image.h"
+#include "Serializer.h"
+
+#include "R/Protect.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace rir {
+
+namespace {
+
+#define IMAGE_MAGIC (uint32_t)0x52495249
+#define IMAGE_VERSION (uint32_t)2
+
+#pragma pack(push)
+#pragma pack(1)
+struct ImageHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entries;
+    uint32_t fingerprint; /// Serializer::fingerprint() of the writing build
+};
+
+struct ImageEntry {
+    uint64_t key;
+    uint64_t offset; /// relative to the start of the file
+    uint64_t length;
+};
+#pragma pack(pop)
+
+struct MappedImage {
+    const uint8_t* data;
+    size_t size;
+
+    const ImageHeader* header() { return (const ImageHeader*)data; }
+    const ImageEntry* begin() { return (const ImageEntry*)(header() + 1); }
+    const ImageEntry* end() { return begin() + header()->entries; }
+};
+
+std::vector<MappedImage> images;
+
+const uint64_t FNV_OFFSET = 0xcbf29ce484222325ULL;
+const uint64_t FNV_PRIME = 0x100000001b3ULL;
+
+uint64_t hashBytes(const void* data, size_t length, uint64_t h) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < length; ++i) {
+        h ^= bytes[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+/** Hash of the structure of an AST. Pointers are never hashed, so that the
+ *  hash is the same in every R session. Attributes (eg. srcrefs) are ignored.
+ */
+uint64_t hashAst(SEXP e, uint64_t h) {
+    int type = TYPEOF(e);
+    h = hashBytes(&type, sizeof(type), h);
+    switch (type) {
+    case SYMSXP:
+        return hashAst(PRINTNAME(e), h);
+    case CHARSXP:
+        return hashBytes(CHAR(e), LENGTH(e), h);
+    case LISTSXP:
+    case LANGSXP:
+    case DOTSXP:
+        for (; e != R_NilValue && (TYPEOF(e) == LISTSXP ||
+                                   TYPEOF(e) == LANGSXP || TYPEOF(e) == DOTSXP);
+             e = CDR(e)) {
+            h = hashAst(TAG(e), h);
+            h = hashAst(CAR(e), h);
+        }
+        return h;
+    case LGLSXP:
+    case INTSXP:
+        return hashBytes(INTEGER(e), XLENGTH(e) * sizeof(int), h);
+    case REALSXP:
+        return hashBytes(REAL(e), XLENGTH(e) * sizeof(double), h);
+    case CPLXSXP:
+        return hashBytes(COMPLEX(e), XLENGTH(e) * sizeof(Rcomplex), h);
+    case RAWSXP:
+        return hashBytes(RAW(e), XLENGTH(e), h);
+    case STRSXP:
+        for (R_xlen_t i = 0; i < XLENGTH(e); ++i)
+            h = hashAst(STRING_ELT(e, i), h);
+        return h;
+    case VECSXP:
+    case EXPRSXP:
+        for (R_xlen_t i = 0; i < XLENGTH(e); ++i)
+            h = hashAst(VECTOR_ELT(e, i), h);
+        return h;
+    default:
+        return h;
+    }
+}
+
+SEXP callBase(const char* fun, SEXP arg, SEXP arg2 = nullptr) {
+    Protect p;
+    SEXP call = p(arg2 ? Rf_lang3(Rf_install(fun), arg, arg2)
+                       : Rf_lang2(Rf_install(fun), arg));
+    return Rf_eval(call, R_BaseEnv);
+}
+}
+
+uint64_t Image::hash(SEXP body, SEXP formals) {
+    return hashAst(formals, hashAst(body, FNV_OFFSET));
+}
+
+void Image::write(const char* path, SEXP packed) {
+    assert(TYPEOF(packed) == VECSXP);
+    Protect p;
+    R_xlen_t n = XLENGTH(packed);
+
+    SEXP data = p(Rf_allocVector(VECSXP, n));
+    std::vector<ImageEntry> entries;
+    uint64_t offset = sizeof(ImageHeader) + n * sizeof(ImageEntry);
+    for (R_xlen_t i = 0; i < n; ++i) {
+        SEXP pc = VECTOR_ELT(packed, i);
+        if (!Serializer::isPacked(pc))
+            Rf_error("element %d is not a packed rir closure", (int)i + 1);
+        SEXP bytes = callBase("serialize", pc, R_NilValue);
+        SET_VECTOR_ELT(data, i, bytes);
+        entries.push_back(
+            {hash(Serializer::body(pc), Serializer::formals(pc)), offset,
+             (uint64_t)XLENGTH(bytes)});
+        offset += XLENGTH(bytes);
+    }
+
+    // Sort the entries, but keep the data in the original order
+    std::sort(entries.begin(), entries.end(),
+              [](const ImageEntry& a, const ImageEntry& b) {
+                  return a.key < b.key || (a.key == b.key && a.offset < b.offset);
+              });
+
+    FILE* f = fopen(path, "wb");
+    if (!f)
+        Rf_error("cannot open %s for writing", path);
+    ImageHeader header = {IMAGE_MAGIC, IMAGE_VERSION, (uint32_t)n,
+                          Serializer::fingerprint()};
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    if (n)
+        ok = ok &&
+             fwrite(entries.data(), sizeof(ImageEntry), n, f) == (size_t)n;
+    for (R_xlen_t i = 0; i < n && ok; ++i) {
+        SEXP bytes = VECTOR_ELT(data, i);
+        ok = fwrite(RAW(bytes), 1, XLENGTH(bytes), f) == (size_t)XLENGTH(bytes);
+    }
+    if (fclose(f) != 0 || !ok)
+        Rf_error("cannot write image %s", path);
+}
+
+int Image::load(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(ImageHeader)) {
+        close(fd);
+        return -1;
+    }
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return -1;
+
+    MappedImage image = {(const uint8_t*)data, (size_t)st.st_size};
+    const ImageHeader* header = image.header();
+    bool valid = header->magic == IMAGE_MAGIC &&
+                 header->version == IMAGE_VERSION &&
+                 header->fingerprint == Serializer::fingerprint() &&
+                 sizeof(ImageHeader) + header->entries * sizeof(ImageEntry) <=
+                     image.size;
+    for (auto e = image.begin(); valid && e != image.end(); ++e)
+        valid = e->offset + e->length <= image.size;
+    if (!valid) {
+        munmap(data, st.st_size);
+        return -1;
+    }
+
+    images.push_back(image);
+    return header->entries;
+}
+
+SEXP Image::lookup(SEXP body, SEXP formals) {
+    if (images.empty())
+        return nullptr;
+
+    uint64_t key = hash(body, formals);
+    for (auto& image : images) {
+        auto range = std::equal_range(
+            image.begin(), image.end(), ImageEntry({key, 0, 0}),
+            [](const ImageEntry& a, const ImageEntry& b) {
+                return a.key < b.key;
+            });
+        for (auto e = range.first; e != range.second; ++e) {
+            Protect p;
+            SEXP bytes = p(Rf_allocVector(RAWSXP, e->length));
+            memcpy(RAW(bytes), image.data + e->offset, e->length);
+            SEXP packed = p(callBase("unserialize", bytes));
+            // the hash can collide, make sure this is really the same closure
+            // (flags as in identical(), ie. srcrefs are ignored)
+            if (Serializer::isPacked(packed) &&
+                R_compute_identical(Serializer::body(packed), body, 16) &&
+                R_compute_identical(Serializer::formals(packed), formals, 16))
+                return packed;
+        }
+    }
+    return nullptr;
+}
+}
@@ -0,0 +1,47 @@
+#ifndef RIR_IMAGE_H
+#define RIR_IMAGE_H
+
+#include "R/r.h"
+
+#include <cstdint>
+
+namespace rir {
+
+/** A precompiled image is a file of packed closures (see Serializer), keyed
+ *  by a structural hash of their body and formals.
+ *
+ *  Images are mmapped when loaded, and nothing is unpacked until the
+ *  compiler asks for a closure with a matching key. This way loading an
+ *  image for all of base is cheap, and closures which are never called never
+ *  get copied into the R heap.
+ *
+ *  Layout of the file:
+ *
+ *    ImageHeader
+ *    ImageEntry[entries]   sorted by key
+ *    data                  the R serialized packed closures
+ *
+ *  Images are only valid for the R and rir build they were created with, the
+ *  header records its Serializer::fingerprint() and others are rejected.
+ */
+class Image {
+  public:
+    /** Writes a list of packed closures to an image file. */
+    static void write(const char* path, SEXP packed);
+
+    /** Maps the image file, returns the number of closures it contains or
+     *  -1 if the file is missing or not a valid image. Does not call into R,
+     *  so that it can be used at startup.
+     */
+    static int load(const char* path);
+
+    /** Returns the packed closure with the given body and formals from any of
+     *  the loaded images, or nullptr.
+     */
+    static SEXP lookup(SEXP body, SEXP formals);
+
+    static uint64_t hash(SEXP body, SEXP formals);
+};
+}
+
+#endif
@@ -0,0 +1,386 @@
+#include "Serializer.h"
+
+#include "R/Funtab.h"
+#include "R/Protect.h"
+#include "interpreter/interp.h"
+#include "interpreter/runtime.h"
+#include "ir/BC.h"
+#include "ir/CodeVerifier.h"
+#include "runtime/DispatchTable.h"
+#include "utils/Pool.h"
+
+#include <Rversion.h>
+
+#include <unordered_map>
+#include <vector>
+
+namespace rir {
+
+namespace {
+
+// Bumped whenever the packed form changes, changes of the layout of Function,
+// Code or the bytecode are caught by the fingerprint.
+const int PACKED_VERSION = 2;
+
+enum PackedField {
+    CODE = 0,
+    CP,
+    CP_KIND,
+    SRC,
+    FORMALS,
+    VERSION,
+    PACKED_LENGTH
+};
+
+/** How a constant is restored when unpacking. */
+enum ConstKind {
+    // Serialized by R as is
+    VALUE = 0,
+    // A primitive or .Internal, referenced by its name in R_FunTab
+    BUILTIN,
+    // A closure found by looking up the stored symbol from the global env
+    // (only used for guard_fun_ targets)
+    GLOBAL,
+    // A nested rir function (ie. the body of a close_), packed recursively
+    NESTED,
+};
+
+const PoolIdxT NO_NAME = (PoolIdxT)-1;
+
+int builtinIndex(const char* name) {
+    for (int i = 0; R_FunTab[i].name; ++i)
+        if (strcmp(R_FunTab[i].name, name) == 0)
+            return i;
+    return -1;
+}
+
+SEXP restoreBuiltin(SEXP name) {
+    const char* n = CHAR(STRING_ELT(name, 0));
+    int i = builtinIndex(n);
+    if (i == -1)
+        Rf_error("unknown builtin %s in packed rir code", n);
+    SEXP sym = Rf_install(n);
+    // .Internal functions are not bound in base
+    return ((R_FunTab[i].eval % 100) / 10) ? sym->u.symsxp.internal
+                                           : SYMVALUE(sym);
+}
+
+SEXP wrapInDispatchTable(SEXP fun) {
+    Protect p(fun);
+    DispatchTable* vtable = DispatchTable::create(1);
+    vtable->put(0, Function::unpack(fun));
+    return vtable->container();
+}
+
+Function* baseline(SEXP what) {
+    if (TYPEOF(what) == CLOSXP)
+        what = BODY(what);
+    Function* fun = nullptr;
+    if (DispatchTable* t = isValidDispatchTableObject(what))
+        fun = t->first();
+    else
+        fun = isValidFunctionObject(what);
+    if (!fun)
+        return nullptr;
+    while (fun->origin())
+        fun = Function::unpack(fun->origin());
+    return fun;
+}
+
+class Packer {
+  public:
+    explicit Packer(Protect& p) : p(p) {}
+
+    PoolIdxT constant(PoolIdxT idx, PoolIdxT nameIdx) {
+        auto known = cpIdx.find(idx);
+        if (known != cpIdx.end())
+            return known->second;
+
+        SEXP c = cp_pool_at(globalContext(), idx);
+        ConstKind kind = VALUE;
+        if (TYPEOF(c) == BUILTINSXP || TYPEOF(c) == SPECIALSXP) {
+            kind = BUILTIN;
+            c = p(Rf_mkString(R_FunTab[((sexprec_rjit*)c)->u.i].name));
+        } else if (TYPEOF(c) == CLOSXP && nameIdx != NO_NAME) {
+            kind = GLOBAL;
+            c = cp_pool_at(globalContext(), nameIdx);
+        } else if (TYPEOF(c) == EXTERNALSXP) {
+            kind = NESTED;
+            c = p(Serializer::pack(c));
+            if (c == R_NilValue)
+                Rf_error("cannot pack rir code constant");
+        }
+
+        PoolIdxT res = cp.size();
+        cp.push_back(c);
+        cpKind.push_back(kind);
+        cpIdx[idx] = res;
+        return res;
+    }
+
+    // Source indices are 1 based, so that 0 still means no source
+    unsigned source(unsigned idx) {
+        auto known = srcIdx.find(idx);
+        if (known != srcIdx.end())
+            return known->second;
+        src.push_back(src_pool_at(globalContext(), idx));
+        unsigned res = src.size();
+        srcIdx[idx] = res;
+        return res;
+    }
+
+    std::vector<SEXP> cp;
+    std::vector<int> cpKind;
+    std::vector<SEXP> src;
+
+  private:
+    Protect& p;
+    std::unordered_map<PoolIdxT, PoolIdxT> cpIdx;
+    std::unordered_map<unsigned, unsigned> srcIdx;
+};
+
+Function* packedFunction(SEXP packed) {
+    return (Function*)RAW(VECTOR_ELT(packed, CODE));
+}
+}
+
+/** Rewrites all constant and source pool indices of the given function.
+ *
+ *  cp(idx, nameIdx) is called for constant pool indices, nameIdx is the index
+ *  of the guarded name for the target of guard_fun_ and NO_NAME otherwise.
+ *  src(idx) is called for all non zero source pool indices.
+ */
+template <typename CP, typename SRC>
+void Serializer::relocate(Function* fun, CP cp, SRC src) {
+    for (Code* c : *fun) {
+        c->src = src(c->src);
+        unsigned* srcs = c->raw_src();
+        for (unsigned i = 0; i < c->srcLength; ++i)
+            if (srcs[i])
+                srcs[i] = src(srcs[i]);
+        c->perfCounter = 0;
+
+        Opcode* pc = c->code();
+        while (pc < c->endCode()) {
+            BC bc = BC::decode(pc);
+            PoolIdxT* imm = (PoolIdxT*)(pc + 1);
+            switch (bc.bc) {
+            case Opcode::push_:
+            case Opcode::ldfun_:
+            case Opcode::ldarg_:
+            case Opcode::ldvar_:
+            case Opcode::ldvar2_:
+            case Opcode::ldlval_:
+            case Opcode::ldddvar_:
+            case Opcode::stvar_:
+            case Opcode::stvar2_:
+            case Opcode::clear_:
+            case Opcode::missing_:
+            case Opcode::subassign2_:
+            case Opcode::lazy_:
+                imm[0] = cp(imm[0], NO_NAME);
+                break;
+            case Opcode::run_lazy_: {
+                // only found in live code, pack the promise stub instead of
+                // the compiled expression
+                Function* f = Function::unpack(Pool::get(imm[0]));
+                SEXP ast = src_pool_at(globalContext(), f->body()->src);
+                *pc = Opcode::lazy_;
+                imm[0] = cp(Pool::insert(ast), NO_NAME);
+                break;
+            }
+            case Opcode::guard_fun_:
+                imm[1] = cp(imm[1], imm[0]);
+                imm[0] = cp(imm[0], NO_NAME);
+                break;
+            case Opcode::guard_env_:
+                Rf_error("cannot pack optimized rir code");
+                break;
+            default:
+                if (bc.isCallsite()) {
+                    CallSite* cs = bc.callSite(c);
+                    cs->call = cp(cs->call, NO_NAME);
+                    if (cs->hasNames)
+                        for (unsigned i = 0; i < cs->nargs; ++i)
+                            cs->names()[i] = cp(cs->names()[i], NO_NAME);
+                    if (cs->hasTarget || cs->hasSelector)
+                        cs->trg = cp(cs->trg, NO_NAME);
+                    if (cs->hasProfile)
+                        memset(cs->profile(), 0, sizeof(CallSiteProfile));
+                }
+                break;
+            }
+            pc = (Opcode*)((uintptr_t)pc + bc.size());
+        }
+    }
+}
+
+SEXP Serializer::pack(SEXP what, SEXP formals) {
+    if (TYPEOF(what) == CLOSXP && formals == R_NilValue)
+        formals = FORMALS(what);
+    Function* fun = baseline(what);
+    if (!fun)
+        return R_NilValue;
+
+    Protect p;
+    SEXP code = p(Rf_allocVector(RAWSXP, fun->size));
+    memcpy(RAW(code), fun, fun->size);
+    Function* copy = (Function*)RAW(code);
+
+    // the copy must not point to anything
+    SEXP* gcArea = (SEXP*)((uintptr_t)copy + copy->info.gc_area_start);
+    for (unsigned i = 0; i < copy->info.gc_area_length; ++i)
+        gcArea[i] = nullptr;
+    copy->invocationCount = 0;
+    copy->deopt = false;
+    copy->markOpt = false;
+
+    Packer packer(p);
+    relocate(copy,
+             [&packer](PoolIdxT idx, PoolIdxT nameIdx) {
+                 return packer.constant(idx, nameIdx);
+             },
+             [&packer](unsigned idx) { return packer.source(idx); });
+
+    SEXP cp = p(Rf_allocVector(VECSXP, packer.cp.size()));
+    SEXP cpKind = p(Rf_allocVector(INTSXP, packer.cp.size()));
+    for (size_t i = 0; i < packer.cp.size(); ++i) {
+        SET_VECTOR_ELT(cp, i, packer.cp[i]);
+        INTEGER(cpKind)[i] = packer.cpKind[i];
+    }
+    SEXP src = p(Rf_allocVector(VECSXP, packer.src.size()));
+    for (size_t i = 0; i < packer.src.size(); ++i)
+        SET_VECTOR_ELT(src, i, packer.src[i]);
+
+    SEXP version = p(Rf_allocVector(INTSXP, 2));
+    INTEGER(version)[0] = PACKED_VERSION;
+    INTEGER(version)[1] = (int)fingerprint();
+
+    SEXP res = p(Rf_allocVector(VECSXP, PACKED_LENGTH));
+    SET_VECTOR_ELT(res, CODE, code);
+    SET_VECTOR_ELT(res, CP, cp);
+    SET_VECTOR_ELT(res, CP_KIND, cpKind);
+    SET_VECTOR_ELT(res, SRC, src);
+    SET_VECTOR_ELT(res, FORMALS, formals);
+    SET_VECTOR_ELT(res, VERSION, version);
+    return res;
+}
+
+bool Serializer::isPacked(SEXP packed) {
+    if (TYPEOF(packed) != VECSXP || XLENGTH(packed) != PACKED_LENGTH)
+        return false;
+    SEXP version = VECTOR_ELT(packed, VERSION);
+    return TYPEOF(version) == INTSXP && XLENGTH(version) == 2 &&
+           INTEGER(version)[0] == PACKED_VERSION &&
+           INTEGER(version)[1] == (int)fingerprint() &&
+           TYPEOF(VECTOR_ELT(packed, CODE)) == RAWSXP &&
+           XLENGTH(VECTOR_ELT(packed, CODE)) >= (R_xlen_t)sizeof(Function) &&
+           packedFunction(packed)->magic == FUNCTION_MAGIC &&
+           (R_xlen_t)packedFunction(packed)->size ==
+               XLENGTH(VECTOR_ELT(packed, CODE));
+}
+
+uint32_t Serializer::fingerprint() {
+    static uint32_t res = 0;
+    if (res)
+        return res;
+
+    // FNV-1a
+    uint64_t h = 0xcbf29ce484222325ULL;
+    auto mix = [&h](const void* data, size_t length) {
+        const uint8_t* bytes = (const uint8_t*)data;
+        for (size_t i = 0; i < length; ++i) {
+            h ^= bytes[i];
+            h *= 0x100000001b3ULL;
+        }
+    };
+
+#define DEF_INSTR(name, imm, opop, opush, pure)                                \
+    {                                                                          \
+        int info[] = {imm, opop, opush, pure};                                 \
+        mix(#name, sizeof(#name));                                             \
+        mix(info, sizeof(info));                                               \
+    }
+#include "ir/insns.h"
+
+    size_t layout[] = {sizeof(Function), sizeof(Code), sizeof(CallSite),
+                       sizeof(ArgT)};
+    mix(layout, sizeof(layout));
+    int version = R_VERSION;
+    mix(&version, sizeof(version));
+
+    res = (uint32_t)(h ^ (h >> 32));
+    if (!res)
+        res = 1;
+    return res;
+}
+
+SEXP Serializer::formals(SEXP packed) {
+    assert(isPacked(packed));
+    return VECTOR_ELT(packed, FORMALS);
+}
+
+SEXP Serializer::body(SEXP packed) {
+    assert(isPacked(packed));
+    unsigned idx = packedFunction(packed)->body()->src;
+    return VECTOR_ELT(VECTOR_ELT(packed, SRC), idx - 1);
+}
+
+SEXP Serializer::unpack(SEXP packed) {
+    if (!isPacked(packed))
+        Rf_error("not packed rir code, or packed by an incompatible version");
+
+    Protect p;
+    SEXP cp = VECTOR_ELT(packed, CP);
+    SEXP cpKind = VECTOR_ELT(packed, CP_KIND);
+    SEXP src = VECTOR_ELT(packed, SRC);
+
+    std::vector<PoolIdxT> cpMap(XLENGTH(cp));
+    for (R_xlen_t i = 0; i < XLENGTH(cp); ++i) {
+        SEXP c = VECTOR_ELT(cp, i);
+        switch (INTEGER(cpKind)[i]) {
+        case VALUE:
+            break;
+        case BUILTIN:
+            c = restoreBuiltin(c);
+            break;
+        case GLOBAL:
+            c = findFun(c, R_GlobalEnv);
+            break;
+        case NESTED:
+            c = p(wrapInDispatchTable(unpack(c)));
+            break;
+        default:
+            Rf_error("corrupted packed rir code");
+        }
+        cpMap[i] = Pool::insert(c);
+    }
+
+    std::vector<unsigned> srcMap(XLENGTH(src) + 1, 0);
+    for (R_xlen_t i = 0; i < XLENGTH(src); ++i)
+        srcMap[i + 1] = src_pool_add(globalContext(), VECTOR_ELT(src, i));
+
+    SEXP code = VECTOR_ELT(packed, CODE);
+    SEXP store = p(Rf_allocVector(EXTERNALSXP, pad4(XLENGTH(code))));
+    // it is ok to bypass the write barrier, the gc area of the packed
+    // function is cleared
+    memcpy(INTEGER(store), RAW(code), XLENGTH(code));
+    Function* fun = Function::unpack(store);
+
+    relocate(fun, [&cpMap](PoolIdxT idx, PoolIdxT) { return cpMap.at(idx); },
+             [&srcMap](unsigned idx) { return srcMap.at(idx); });
+
+    CodeVerifier::verifyFunctionLayout(store, globalContext());
+    return store;
+}
+
+SEXP Serializer::unpackClosure(SEXP packed, SEXP env) {
+    Protect p;
+    SEXP body = p(wrapInDispatchTable(unpack(packed)));
+    SEXP closure = p(allocSExp(CLOSXP));
+    SET_BODY(closure, body);
+    SET_FORMALS(closure, formals(packed));
+    SET_CLOENV(closure, env);
+    return closure;
+}
+}
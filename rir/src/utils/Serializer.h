@@ -0,0 +1,62 @@
+#ifndef RIR_SERIALIZER_H
+#define RIR_SERIALIZER_H
+
+#include "R/r.h"
+#include "runtime/Function.h"
+
+namespace rir {
+
+/** Converts rir Functions to and from a relocatable form.
+ *
+ *  The packed form is a plain R list which can be written with saveRDS,
+ *  stored in an image, or shipped to another R process:
+ *
+ *    code     the Function bytes (RAWSXP), with all constant and source pool
+ *             indices rewritten to indices into cp and src
+ *    cp       the referenced constants (VECSXP)
+ *    cpKind   how each constant is to be restored (INTSXP, see Serializer.cpp)
+ *    src      the referenced source ASTs (VECSXP)
+ *    formals  formals of the closure the function was compiled for
+ *    version  PACKED_VERSION and the fingerprint of the build
+ *
+ *  Only baseline (ie. unoptimized) functions can be packed, since optimized
+ *  versions refer to deoptimization info which is local to the process.
+ *  Call site profiles are reset.
+ */
+class Serializer {
+  public:
+    /** Packs the baseline version of a rir closure, dispatch table or
+     *  function. Returns R_NilValue if there is nothing to pack.
+     */
+    static SEXP pack(SEXP what, SEXP formals = R_NilValue);
+
+    /** Recreates the Function from a packed form, adding its constants to the
+     *  pools of the global context. Returns the Function's container.
+     */
+    static SEXP unpack(SEXP packed);
+
+    /** Creates a rir closure around a packed form. */
+    static SEXP unpackClosure(SEXP packed, SEXP env);
+
+    /** Returns true if the argument looks like a packed form. */
+    static bool isPacked(SEXP packed);
+
+    /** Formals stored in a packed form. */
+    static SEXP formals(SEXP packed);
+
+    /** Source AST of the body of a packed form. */
+    static SEXP body(SEXP packed);
+
+    /** Identifies the build: a hash of the opcode table, the layout of
+     *  Function and Code and the R version. Packed forms and images only load
+     *  into a build with the same fingerprint.
+     */
+    static uint32_t fingerprint();
+
+  private:
+    template <typename CP, typename SRC>
+    static void relocate(Function* fun, CP cp, SRC src);
+};
+}
+
+#endif